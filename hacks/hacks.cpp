@@ -18,3 +18,64 @@ void QWaylandExtendedSurface::extended_surface_onscreen_visibility(int32_t /*vis
 }
 
 }
+
+// Qt swaps window buffers with plain eglSwapBuffers(), which makes the host
+// compositor repaint the whole window. The compositor sets the damage of its
+// next frame here, and the swap is done with it instead.
+
+#include <dlfcn.h>
+#define MESA_EGL_NO_X11_HEADERS
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+static const EGLint maxSwapDamageRects = 16;
+
+// Per thread, as windows can be drawn and swapped on render threads.
+static thread_local EGLSurface swapDamageSurface = EGL_NO_SURFACE;
+static thread_local EGLint swapDamageRects[maxSwapDamageRects * 4];
+static thread_local EGLint swapDamageRectCount = 0;
+
+extern "C" __attribute__((visibility("default")))
+void newcompositor_set_swap_damage(EGLSurface surface, const EGLint *rects,
+                                   EGLint nRects)
+{
+    if (nRects > maxSwapDamageRects) {
+        // Too many to keep, let the whole surface be damaged.
+        nRects = 0;
+    }
+    swapDamageSurface = surface;
+    for (EGLint i = 0; i < nRects * 4; i++) {
+        swapDamageRects[i] = rects[i];
+    }
+    swapDamageRectCount = nRects;
+}
+
+extern "C" __attribute__((visibility("default")))
+EGLBoolean eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
+{
+    typedef EGLBoolean (*SwapBuffersFunc)(EGLDisplay, EGLSurface);
+    static auto realSwapBuffers = reinterpret_cast<SwapBuffersFunc>(
+                ::dlsym(RTLD_NEXT, "eglSwapBuffers"));
+    static auto swapBuffersWithDamage = [] {
+        auto func = reinterpret_cast<PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC>(
+                    ::eglGetProcAddress("eglSwapBuffersWithDamageKHR"));
+        if (!func) {
+            func = reinterpret_cast<PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC>(
+                        ::eglGetProcAddress("eglSwapBuffersWithDamageEXT"));
+        }
+        return func;
+    }();
+
+    if (surface == swapDamageSurface && swapDamageRectCount > 0 &&
+            swapBuffersWithDamage) {
+        const EGLint nRects = swapDamageRectCount;
+        swapDamageSurface = EGL_NO_SURFACE;
+        swapDamageRectCount = 0;
+        return swapBuffersWithDamage(dpy, surface, swapDamageRects, nRects);
+    }
+    if (surface == swapDamageSurface) {
+        swapDamageSurface = EGL_NO_SURFACE;
+    }
+    return realSwapBuffers(dpy, surface);
+}
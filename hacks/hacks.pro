@@ -4,6 +4,11 @@ CONFIG += unversioned_libname
 
 SOURCES += hacks.cpp
 
+CONFIG += link_pkgconfig
+PKGCONFIG += egl
+
+LIBS += -ldl
+
 TARGET = newcompositorhacks
 
 target.path = /usr/lib/newcompositor
@@ -15,8 +15,12 @@ BuildRequires:  opt-qt5-qtbase-devel >= 5.15.8
 BuildRequires:  opt-qt5-qtdeclarative-devel >= 5.15.8
 BuildRequires:  opt-qt5-qtquickcontrols2-devel >= 5.15.8
 BuildRequires:  opt-qt5-qtwayland-devel >= 5.15.8
+BuildRequires:  pkgconfig(egl)
+BuildRequires:  pkgconfig(wayland-client)
+BuildRequires:  pkgconfig(wayland-protocols) >= 1.31
 BuildRequires:  pkgconfig(xcb)
 BuildRequires:  pkgconfig(xcb-composite)
+BuildRequires:  pkgconfig(xcb-sync)
 BuildRequires:  pkgconfig(xkbcommon)
 BuildRequires:  pkgconfig(wayland-server)
 BuildRequires:  systemd
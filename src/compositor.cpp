@@ -58,6 +58,7 @@
 #include <QWaylandOutput>
 #include <QWaylandSeat>
 #include <QWaylandSurface>
+#include <QWaylandViewporter>
 #include <QWaylandWlShell>
 #include <QWaylandWlShellSurface>
 #include <QWaylandXdgPopup>
@@ -67,6 +68,9 @@
 #include <QWindow>
 
 #include "dbuscontainerstate.h"
+#include "fractionalscale.h"
+#include "presentationtime.h"
+#include "texturemanager.h"
 #include "view.h"
 #include "window.h"
 #ifdef XWAYLAND
@@ -75,17 +79,25 @@
 #include "xwmwindow.h"
 #endif
 
+// Memory pressure events further apart than this, in ms, are of separate
+// episodes.
+static const qint64 memoryPressureGap = 10000;
+
 Compositor::Compositor()
     : m_dbusContainerState(new DBusContainerState(this))
     , m_wlShell(new QWaylandWlShell(this))
     , m_xdgShell(new QWaylandXdgShell(this))
     , m_xdgDecorationManager(new QWaylandXdgDecorationManagerV1)
+    , m_presentation(new PresentationTime(this))
+    , m_viewporter(new QWaylandViewporter(this))
+    , m_fractionalScale(new FractionalScaleManager(this))
 #ifdef XWAYLAND
     , m_xwayland(new Xwayland(this))
     , m_xwm(new Xwm(this, m_xwayland))
 #endif
 {
     m_xdgDecorationManager->setParent(this);
+    m_singleWindow = qEnvironmentVariableIntValue("NEWCOMPOSITOR_SINGLE_WINDOW");
 }
 
 Compositor::~Compositor()
@@ -115,6 +127,10 @@ void Compositor::create()
     m_xdgDecorationManager->initialize();
     m_xdgDecorationManager->setPreferredMode(QWaylandXdgToplevel::ServerSideDecoration);
 
+    m_presentation->initialize();
+    m_viewporter->initialize();
+    m_fractionalScale->initialize();
+
     // Some clients, e.g. Xwayland in rootful mode, expect to know output
     // size before they create any surfaces.
 //    auto *output = new QWaylandOutput(this, nullptr);
@@ -130,13 +146,37 @@ void Compositor::create()
 
     qInfo("Compositor running on WAYLAND_DISPLAY=%s", socketName().constData());
 
+    connect(TextureManager::instance(), &TextureManager::memoryPressure,
+            this, &Compositor::onMemoryPressure);
+
 #ifdef XWAYLAND
     connect(m_xwm, &Xwm::windowBoundToSurface,
             this, &Compositor::onXwmWindowBoundToSurface);
-    m_xwayland->start();
+    m_xwayland->listen();
 #endif
 }
 
+void Compositor::onMemoryPressure()
+{
+    const qint64 textureBytes = TextureManager::instance()->textureBytes();
+    const QList<QWaylandOutput *> outputList = outputs();
+    for (QWaylandOutput *output : outputList) {
+        auto *window = qobject_cast<Window *>(output->window());
+        if (window) {
+            window->releaseHiddenTextures();
+        }
+    }
+    // The trigger fires again every window for as long as the pressure
+    // lasts, so only the start of it is logged.
+    const bool started = (!m_memoryPressureTimer.isValid() ||
+                          m_memoryPressureTimer.elapsed() > memoryPressureGap);
+    m_memoryPressureTimer.start();
+    if (started) {
+        qInfo("memory pressure: freed %lld bytes of textures of hidden views",
+              textureBytes - TextureManager::instance()->textureBytes());
+    }
+}
+
 void Compositor::onSurfaceCreated(QWaylandSurface *surface)
 {
     new View(this, surface);
@@ -150,6 +190,15 @@ void Compositor::onSurfaceCreated(QWaylandSurface *surface)
 }
 
 bool Compositor::surfaceHasContent(QWaylandSurface *surface) const
+{
+    if (!surfaceIsMapped(surface)) {
+        return false;
+    }
+    auto *view = qobject_cast<View *>(surface->primaryView());
+    return !view->m_background;
+}
+
+bool Compositor::surfaceIsMapped(QWaylandSurface *surface) const
 {
     bool hasContent = surface->hasContent();
     if (hasContent) {
@@ -173,13 +222,21 @@ void Compositor::surfaceHasContentChanged()
     if (!view) {
         return;
     }
-    if (surfaceHasContent(surface) && !surface->isCursorSurface()) {
-        auto *view = qobject_cast<View *>(surface->primaryView());
-        Q_ASSERT(view);
+    if (surfaceIsMapped(surface) && !surface->isCursorSurface()) {
         Window *window = ensureWindowForView(view);
+        if (view->m_background) {
+            // A toplevel of a shared window comes to the front when it is
+            // shown again.
+            window->raiseToplevel(view);
+        }
         if (window->isActive()) {
             setFocusSurface(surface);
         }
+    } else if (view->output()) {
+        auto *window = qobject_cast<Window *>(view->output()->window());
+        if (window && window->currentToplevel() == view) {
+            window->showPreviousToplevel();
+        }
     }
     triggerRender(surface);
 }
@@ -199,7 +256,7 @@ void Compositor::onSubsurfacePositionChanged(const QPoint &position)
     Q_ASSERT(surface->primaryView());
     auto *view = qobject_cast<View *>(surface->primaryView());
     Q_ASSERT(view);
-    view->m_position = position;
+    view->setPosition(position);
     triggerRender(surface);
 }
 
@@ -237,6 +294,17 @@ void Compositor::setFocusSurface(QWaylandSurface *surface)
 
 Window *Compositor::createWindow(View *view)
 {
+    // A shared window without views is about to be deleted.
+    if (m_sharedWindow && !m_sharedWindow->views().isEmpty()) {
+        Window *window = m_sharedWindow;
+        view->setOutput(outputFor(window));
+        window->addView(view);
+        connect(window, &Window::outputSizeChanged,
+                view, &View::onOutputSizeChanged);
+        view->onOutputSizeChanged();
+        return window;
+    }
+
     auto *window = new Window(this);
     connect(window, &Window::rotationChanged,
             m_dbusContainerState, &DBusContainerState::onWindowRotationChanged);
@@ -252,9 +320,12 @@ Window *Compositor::createWindow(View *view)
     view->setOutput(output);
     window->addView(view);
 
-    connect(output, &QWaylandOutput::geometryChanged,
-            view, &View::onOutputGeometryChanged);
+    connect(window, &Window::outputSizeChanged,
+            view, &View::onOutputSizeChanged);
 
+    if (m_singleWindow) {
+        m_sharedWindow = window;
+    }
     return window;
 }
 
@@ -323,7 +394,7 @@ void Compositor::onWlShellSurfaceSetTransient(QWaylandSurface *parentSurface,
     auto *parentView = qobject_cast<View *>(parentSurface->primaryView());
     Q_ASSERT(parentView);
     view->m_parentView = parentView;
-    view->m_position = parentView->position() + relativeToParent;
+    view->setPosition(parentView->position() + relativeToParent);
 }
 
 void Compositor::onWlShellSurfaceSetPopup(QWaylandSeat *seat,
@@ -337,7 +408,7 @@ void Compositor::onWlShellSurfaceSetPopup(QWaylandSeat *seat,
     auto *parentView = qobject_cast<View *>(parentSurface->primaryView());
     Q_ASSERT(parentView);
     view->m_parentView = parentView;
-    view->m_position = parentView->position() + relativeToParent;
+    view->setPosition(parentView->position() + relativeToParent);
 }
 
 void Compositor::onXdgToplevelCreated(QWaylandXdgToplevel *toplevel,
@@ -356,9 +427,9 @@ void Compositor::onXdgPopupCreated(QWaylandXdgPopup *popup,
     auto *parentView = qobject_cast<View *>(popup->parentXdgSurface()->surface()->primaryView());
     Q_ASSERT(parentView);
     view->m_parentView = parentView;
-    view->m_position = (parentView->position() +
-                        popup->anchorRect().topLeft() +
-                        popup->offset());
+    view->setPosition(parentView->position() +
+                      popup->anchorRect().topLeft() +
+                      popup->offset());
     view->m_xdgPopup = popup;
 }
 
@@ -382,6 +453,8 @@ void Compositor::onXwmWindowBoundToSurface(XwmWindow *xwmWindow,
             Qt::DirectConnection);
     connect(xwmWindow, &XwmWindow::positionChanged,
             this, &Compositor::onXwmWindowPositionChanged);
+    connect(xwmWindow, &XwmWindow::resizeFinished,
+            this, &Compositor::onXwmWindowResizeFinished);
     connect(xwmWindow, &XwmWindow::setPopup,
             this, &Compositor::onXwmWindowSetPopup);
 }
@@ -392,7 +465,16 @@ void Compositor::onXwmWindowPositionChanged(const QPoint &pos)
     auto *view = qobject_cast<View *>(xwmWindow->surface()->primaryView());
     Q_ASSERT(view);
     if (view->m_parentView) {
-        view->m_position = pos;
+        view->setPosition(pos);
+    }
+}
+
+void Compositor::onXwmWindowResizeFinished()
+{
+    // The window held its frames while the client was drawing.
+    auto *xwmWindow = qobject_cast<XwmWindow *>(sender());
+    if (xwmWindow->surface()) {
+        triggerRender(xwmWindow->surface());
     }
 }
 
@@ -410,15 +492,12 @@ void Compositor::onXwmWindowSetPopup(QWaylandSurface *parentSurface,
         // If parent surface is unknown, make it a popup of the active window.
         auto *window = qobject_cast<Window *>(QGuiApplication::focusWindow());
         if (window) {
-            const QVector<View *> views = window->views();
-            if (!views.isEmpty()) {
-                parentView = views.first();
-            }
+            parentView = window->currentToplevel();
         }
     }
     if (parentView) {
         view->m_parentView = parentView;
-        view->m_position = pos;
+        view->setPosition(pos);
     }
 }
 #endif // XWAYLAND
@@ -426,7 +505,8 @@ void Compositor::onXwmWindowSetPopup(QWaylandSurface *parentSurface,
 void Compositor::triggerRender(QWaylandSurface *surface)
 {
     if (surface->primaryView() && surface->primaryView()->output()) {
-        Q_ASSERT(surface->primaryView()->output()->window());
-        surface->primaryView()->output()->window()->requestUpdate();
+        auto *window = qobject_cast<Window *>(surface->primaryView()->output()->window());
+        Q_ASSERT(window);
+        window->scheduleRepaint();
     }
 }
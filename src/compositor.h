@@ -51,6 +51,7 @@
 #ifndef COMPOSITOR_H
 #define COMPOSITOR_H
 
+#include <QElapsedTimer>
 #include <QPoint>
 #include <QPointer>
 #include <QWaylandCompositor>
@@ -59,6 +60,7 @@ QT_BEGIN_NAMESPACE
 
 class QWaylandOutput;
 class QWaylandSurface;
+class QWaylandViewporter;
 class QWaylandWlShell;
 class QWaylandWlShellSurface;
 class QWaylandXdgDecorationManagerV1;
@@ -68,6 +70,8 @@ class QWaylandXdgSurface;
 class QWaylandXdgToplevel;
 
 class DBusContainerState;
+class FractionalScaleManager;
+class PresentationTime;
 class View;
 class Window;
 #ifdef XWAYLAND
@@ -87,9 +91,15 @@ public:
     Window *showAgainWindow();
     void setShowAgainWindow(Window *window);
 
+    // Whether the surface is shown, which it is not when its toplevel is
+    // behind another in a shared window even if it is mapped.
     bool surfaceHasContent(QWaylandSurface *surface) const;
+    bool surfaceIsMapped(QWaylandSurface *surface) const;
     void setFocusSurface(QWaylandSurface *surface);
 
+    PresentationTime *presentation() const { return m_presentation; }
+    FractionalScaleManager *fractionalScale() const { return m_fractionalScale; }
+
 signals:
     void frameOffset(const QPoint &offset);
     void surfaceReady(QWaylandSurface *surface);
@@ -99,6 +109,7 @@ private slots:
     void triggerRender(QWaylandSurface *surface);
 
     void onOutputAdded(QWaylandOutput *output);
+    void onMemoryPressure();
 
     void onSurfaceCreated(QWaylandSurface *surface);
     void surfaceHasContentChanged();
@@ -122,6 +133,7 @@ private slots:
     void onXwmWindowBoundToSurface(XwmWindow *XwmWindow,
                                    QWaylandSurface *previousSurface);
     void onXwmWindowPositionChanged(const QPoint &pos);
+    void onXwmWindowResizeFinished();
     void onXwmWindowSetPopup(QWaylandSurface *parentSurface,
                              const QPoint &pos);
 #endif
@@ -131,10 +143,19 @@ private:
     Window *createWindow(View *view);
 
     QPointer<Window> m_showAgainWindow;
+    // With NEWCOMPOSITOR_SINGLE_WINDOW=1, all toplevels are composited
+    // into one host window, and only the one on top is shown.
+    bool m_singleWindow = false;
+    QPointer<Window> m_sharedWindow;
+    // Since the last memory pressure event.
+    QElapsedTimer m_memoryPressureTimer;
     DBusContainerState *m_dbusContainerState;
     QWaylandWlShell *m_wlShell;
     QWaylandXdgShell *m_xdgShell;
     QWaylandXdgDecorationManagerV1 *m_xdgDecorationManager;
+    PresentationTime *m_presentation;
+    QWaylandViewporter *m_viewporter;
+    FractionalScaleManager *m_fractionalScale;
 #ifdef XWAYLAND
     Xwayland *m_xwayland;
     Xwm *m_xwm;
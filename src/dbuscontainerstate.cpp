@@ -6,10 +6,14 @@
 #include <QDebug>
 
 #include "compositor.h"
+#include "dbusstatistics.h"
+#include "dbustrace.h"
 
 DBusContainerState::DBusContainerState(Compositor *compositor)
     : QObject(compositor)
     , m_compositor(compositor)
+    , m_statistics(new DBusStatistics(compositor, this))
+    , m_trace(new DBusTrace(this))
 {
     QStringList arguments = QCoreApplication::instance()->arguments();
 
@@ -36,6 +40,10 @@ void DBusContainerState::onNewConnection(const QDBusConnection &connection)
                        QDBusConnection::ExportAllProperties |
                        QDBusConnection::ExportAllSignals |
                        QDBusConnection::ExportAllSlots);
+    con.registerObject("/", NEWCOMPOSITOR_DBUS_STATS_IFACE, m_statistics,
+                       QDBusConnection::ExportAllSlots);
+    con.registerObject("/", NEWCOMPOSITOR_DBUS_TRACE_IFACE, m_trace,
+                       QDBusConnection::ExportAllSlots);
     con.registerService(FLATPAK_RUNNER_DBUS_CONT_SERVICE);
 }
 
@@ -12,6 +12,8 @@ class QDBusConnection;
 class QDBusServer;
 
 class Compositor;
+class DBusStatistics;
+class DBusTrace;
 
 class DBusContainerState : public QObject
 {
@@ -42,6 +44,8 @@ private slots:
 private:
     Compositor *m_compositor;
     QDBusServer *m_server;
+    DBusStatistics *m_statistics;
+    DBusTrace *m_trace;
     int m_orientation = 0;
 };
 
@@ -0,0 +1,51 @@
+#include "dbusstatistics.h"
+
+#include <QVariantList>
+#include <QWaylandOutput>
+
+#include "compositor.h"
+#include "framestatistics.h"
+#include "repaintscheduler.h"
+#include "texturemanager.h"
+#include "view.h"
+#include "window.h"
+
+DBusStatistics::DBusStatistics(Compositor *compositor, QObject *parent)
+    : QObject(parent)
+    , m_compositor(compositor)
+{
+}
+
+QVariantMap DBusStatistics::statistics()
+{
+    // Someone is watching, so the GPU time is worth measuring for a while.
+    FrameStatistics::requestGpuTiming();
+
+    QVariantList windows;
+    const QList<QWaylandOutput *> outputs = m_compositor->outputs();
+    for (QWaylandOutput *output : outputs) {
+        auto *window = qobject_cast<Window *>(output->window());
+        if (!window) {
+            continue;
+        }
+        QVariantMap windowMap = window->statistics().toVariantMap();
+        windowMap.insert(QStringLiteral("refreshPeriod"),
+                         window->repaintScheduler()->refreshPeriod());
+        windowMap.insert(QStringLiteral("repaintLead"),
+                         window->repaintScheduler()->repaintLead());
+        QVariantList views;
+        const QVector<View *> windowViews = window->views();
+        for (View *view : windowViews) {
+            views << view->statistics();
+        }
+        windowMap.insert(QStringLiteral("views"), views);
+        windows << windowMap;
+    }
+
+    QVariantMap map;
+    map.insert(QStringLiteral("bucketLimits"), Histogram::bucketLimits());
+    map.insert(QStringLiteral("windows"), windows);
+    map.insert(QStringLiteral("textureBytes"),
+               TextureManager::instance()->textureBytes());
+    return map;
+}
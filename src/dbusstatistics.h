@@ -0,0 +1,33 @@
+#ifndef DBUSSTATISTICS_H
+#define DBUSSTATISTICS_H
+
+#include <QObject>
+#include <QVariantMap>
+
+#define NEWCOMPOSITOR_DBUS_STATS_IFACE "org.newcompositor.Statistics"
+
+QT_BEGIN_NAMESPACE
+
+class Compositor;
+
+// Frame statistics of the windows, for monitoring.
+class DBusStatistics : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", NEWCOMPOSITOR_DBUS_STATS_IFACE)
+
+public:
+    DBusStatistics(Compositor *compositor, QObject *parent);
+
+public slots:
+    // Counters since the windows were created. Histograms have counts per
+    // bucket, with the upper limits of the buckets in bucketLimits.
+    QVariantMap statistics();
+
+private:
+    Compositor *m_compositor;
+};
+
+QT_END_NAMESPACE
+
+#endif // DBUSSTATISTICS_H
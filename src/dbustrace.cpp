@@ -0,0 +1,23 @@
+#include "dbustrace.h"
+
+#include "trace.h"
+
+DBusTrace::DBusTrace(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void DBusTrace::start()
+{
+    Trace::setEnabled(true);
+}
+
+void DBusTrace::stop()
+{
+    Trace::setEnabled(false);
+}
+
+QString DBusTrace::events()
+{
+    return QString::fromUtf8(Trace::toJson());
+}
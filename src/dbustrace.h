@@ -0,0 +1,29 @@
+#ifndef DBUSTRACE_H
+#define DBUSTRACE_H
+
+#include <QObject>
+#include <QString>
+
+#define NEWCOMPOSITOR_DBUS_TRACE_IFACE "org.newcompositor.Trace"
+
+QT_BEGIN_NAMESPACE
+
+// Control of the built-in tracing, see Trace.
+class DBusTrace : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", NEWCOMPOSITOR_DBUS_TRACE_IFACE)
+
+public:
+    DBusTrace(QObject *parent);
+
+public slots:
+    void start();
+    void stop();
+    // The most recent events, in the Chrome trace event format.
+    QString events();
+};
+
+QT_END_NAMESPACE
+
+#endif // DBUSTRACE_H
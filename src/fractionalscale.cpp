@@ -0,0 +1,107 @@
+#include "fractionalscale.h"
+
+#include <QGuiApplication>
+#include <QWaylandCompositor>
+#include <QWaylandOutput>
+#include <QWaylandSurface>
+#include <QtMath>
+
+#include "view.h"
+#include "window.h"
+
+FractionalScale::FractionalScale(struct ::wl_client *client, uint32_t id,
+                                 int version, QWaylandSurface *surface)
+    : QtWaylandServer::wp_fractional_scale_v1(client, id, version)
+    , m_surface(surface)
+{
+}
+
+void FractionalScale::sendPreferredScale(qreal scale)
+{
+    const uint32_t scale120 = uint32_t(qRound(scale * 120));
+    if (scale120 != m_scale) {
+        m_scale = scale120;
+        send_preferred_scale(scale120);
+    }
+}
+
+void FractionalScale::wp_fractional_scale_v1_destroy(Resource *resource)
+{
+    wl_resource_destroy(resource->handle);
+}
+
+void FractionalScale::wp_fractional_scale_v1_destroy_resource(Resource *resource)
+{
+    Q_UNUSED(resource);
+    emit fractionalScaleDestroyed(this);
+    delete this;
+}
+
+FractionalScaleManager::FractionalScaleManager(QWaylandCompositor *compositor)
+    : QWaylandCompositorExtensionTemplate<FractionalScaleManager>(compositor)
+    , m_compositor(compositor)
+{
+}
+
+void FractionalScaleManager::initialize()
+{
+    QWaylandCompositorExtensionTemplate::initialize();
+    init(m_compositor->display(), 1);
+}
+
+void FractionalScaleManager::setPreferredScale(QWaylandSurface *surface,
+                                               qreal scale)
+{
+    FractionalScale *fractionalScale = m_fractionalScales.value(surface);
+    if (fractionalScale) {
+        fractionalScale->sendPreferredScale(scale);
+    }
+}
+
+void FractionalScaleManager::wp_fractional_scale_manager_v1_destroy(Resource *resource)
+{
+    wl_resource_destroy(resource->handle);
+}
+
+void FractionalScaleManager::wp_fractional_scale_manager_v1_get_fractional_scale(
+        Resource *resource, uint32_t id, struct ::wl_resource *surfaceResource)
+{
+    QWaylandSurface *surface = QWaylandSurface::fromResource(surfaceResource);
+    if (!surface) {
+        return;
+    }
+    if (m_fractionalScales.contains(surface)) {
+        wl_resource_post_error(resource->handle,
+                               error_fractional_scale_exists,
+                               "the surface already has a fractional scale");
+        return;
+    }
+    auto *fractionalScale = new FractionalScale(resource->client(), id,
+                                                wl_resource_get_version(resource->handle),
+                                                surface);
+    connect(fractionalScale, &FractionalScale::fractionalScaleDestroyed,
+            this, &FractionalScaleManager::onFractionalScaleDestroyed);
+    // The object is inert once the surface is gone.
+    connect(surface, &QWaylandSurface::surfaceDestroyed,
+            fractionalScale, [this, surface] {
+        m_fractionalScales.remove(surface);
+    });
+    m_fractionalScales.insert(surface, fractionalScale);
+
+    // Until the surface is shown in a window, it is expected to be shown on
+    // the primary screen.
+    auto *view = qobject_cast<View *>(surface->primaryView());
+    Window *window = nullptr;
+    if (view && view->output()) {
+        window = qobject_cast<Window *>(view->output()->window());
+    }
+    fractionalScale->sendPreferredScale(window ? window->scale()
+                                               : Window::scaleForScreen(QGuiApplication::primaryScreen()));
+}
+
+void FractionalScaleManager::onFractionalScaleDestroyed(FractionalScale *fractionalScale)
+{
+    if (m_fractionalScales.value(fractionalScale->surface()) == fractionalScale) {
+        m_fractionalScales.remove(fractionalScale->surface());
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef FRACTIONALSCALE_H
+#define FRACTIONALSCALE_H
+
+#include <QHash>
+#include <QObject>
+#include <QWaylandCompositorExtensionTemplate>
+
+#include "qwayland-server-fractional-scale-v1.h"
+
+QT_BEGIN_NAMESPACE
+
+class QWaylandCompositor;
+class QWaylandSurface;
+
+class FractionalScale : public QObject,
+                        public QtWaylandServer::wp_fractional_scale_v1
+{
+    Q_OBJECT
+public:
+    FractionalScale(struct ::wl_client *client, uint32_t id, int version,
+                    QWaylandSurface *surface);
+
+    QWaylandSurface *surface() const { return m_surface; }
+    void sendPreferredScale(qreal scale);
+
+signals:
+    void fractionalScaleDestroyed(FractionalScale *fractionalScale);
+
+protected:
+    void wp_fractional_scale_v1_destroy(Resource *resource) override;
+    void wp_fractional_scale_v1_destroy_resource(Resource *resource) override;
+
+private:
+    // Only used as a key after the surface is destroyed.
+    QWaylandSurface *m_surface;
+    // In 120ths, as sent.
+    uint32_t m_scale = 0;
+};
+
+// Tells clients the scale of the window their surfaces are shown in, so
+// that they can draw at the resolution of the host, through wp_viewporter,
+// instead of at the next whole scale of the output.
+class FractionalScaleManager
+        : public QWaylandCompositorExtensionTemplate<FractionalScaleManager>
+        , public QtWaylandServer::wp_fractional_scale_manager_v1
+{
+    Q_OBJECT
+public:
+    FractionalScaleManager(QWaylandCompositor *compositor);
+    void initialize() override;
+
+    void setPreferredScale(QWaylandSurface *surface, qreal scale);
+
+protected:
+    void wp_fractional_scale_manager_v1_destroy(Resource *resource) override;
+    void wp_fractional_scale_manager_v1_get_fractional_scale(
+            Resource *resource, uint32_t id,
+            struct ::wl_resource *surface) override;
+
+private slots:
+    void onFractionalScaleDestroyed(FractionalScale *fractionalScale);
+
+private:
+    QWaylandCompositor *m_compositor;
+    QHash<QWaylandSurface *, FractionalScale *> m_fractionalScales;
+};
+
+QT_END_NAMESPACE
+
+#endif // FRACTIONALSCALE_H
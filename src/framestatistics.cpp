@@ -0,0 +1,84 @@
+#include "framestatistics.h"
+
+#include <QAtomicInteger>
+#include <QtAlgorithms>
+
+#include "presentationtime.h"
+
+// How long GPU time is measured after the statistics were last read.
+static const qint64 gpuTimingDuration = Q_INT64_C(60000000000);
+
+// Read on render threads.
+static QAtomicInteger<qint64> gpuTimingDeadline;
+
+void Histogram::add(qint64 nsecs)
+{
+    const quint64 msecs = quint64(qMax<qint64>(0, nsecs)) / 1000000;
+    // Number of significant bits: 0 for 0 ms, 1 for 1 ms, 2 for 2-3 ms...
+    const int bucket = (msecs ? 64 - qCountLeadingZeroBits(msecs) : 0);
+    m_buckets[qMin(bucket, bucketCount - 1)]++;
+}
+
+void Histogram::clear()
+{
+    for (quint32 &count : m_buckets) {
+        count = 0;
+    }
+}
+
+QVariantList Histogram::toVariantList() const
+{
+    QVariantList list;
+    list.reserve(bucketCount);
+    for (quint32 count : m_buckets) {
+        list << count;
+    }
+    return list;
+}
+
+QVariantList Histogram::bucketLimits()
+{
+    QVariantList list;
+    for (int i = 0; i < bucketCount - 1; i++) {
+        list << (1 << i);
+    }
+    return list;
+}
+
+void FrameStatistics::recordFrame(qint64 paintTime, qint64 gpuTime,
+                                  int missedFrames)
+{
+    m_frames++;
+    m_missedFrames += missedFrames;
+    m_paintTimes.add(paintTime);
+    if (gpuTime >= 0) {
+        m_gpuTimes.add(gpuTime);
+    }
+}
+
+void FrameStatistics::clear()
+{
+    *this = FrameStatistics();
+}
+
+QVariantMap FrameStatistics::toVariantMap() const
+{
+    QVariantMap map;
+    map.insert(QStringLiteral("frames"), m_frames);
+    map.insert(QStringLiteral("missedFrames"), m_missedFrames);
+    map.insert(QStringLiteral("uploadedBytes"), m_uploadedBytes);
+    map.insert(QStringLiteral("coalescedEvents"), m_coalescedEvents);
+    map.insert(QStringLiteral("paintTime"), m_paintTimes.toVariantList());
+    map.insert(QStringLiteral("gpuTime"), m_gpuTimes.toVariantList());
+    return map;
+}
+
+void FrameStatistics::requestGpuTiming()
+{
+    gpuTimingDeadline.storeRelaxed(qint64(PresentationTime::now()) + gpuTimingDuration);
+}
+
+bool FrameStatistics::isGpuTimingRequested()
+{
+    return qint64(PresentationTime::now()) < gpuTimingDeadline.loadRelaxed();
+}
@@ -0,0 +1,56 @@
+#ifndef FRAMESTATISTICS_H
+#define FRAMESTATISTICS_H
+
+#include <QVariantList>
+#include <QVariantMap>
+
+QT_BEGIN_NAMESPACE
+
+// Counts of durations in buckets of powers of two milliseconds: under 1 ms,
+// under 2 ms, under 4 ms and so on, the last bucket counting the rest.
+class Histogram
+{
+public:
+    static const int bucketCount = 12;
+
+    void add(qint64 nsecs);
+    void clear();
+
+    QVariantList toVariantList() const;
+    // Upper limits of the buckets, in milliseconds.
+    static QVariantList bucketLimits();
+
+private:
+    quint32 m_buckets[bucketCount] = {};
+};
+
+// Statistics of the frames of a window, kept cheap enough to be recorded
+// whether or not anyone reads them.
+class FrameStatistics
+{
+public:
+    void recordFrame(qint64 paintTime, qint64 gpuTime, int missedFrames);
+    void recordUpload(qint64 bytes) { m_uploadedBytes += bytes; }
+    // Input events merged into later ones instead of being sent.
+    void recordCoalescedEvents(int count) { m_coalescedEvents += count; }
+    void clear();
+
+    QVariantMap toVariantMap() const;
+
+    // GPU time is only measured for a while after the statistics have
+    // been read, as timer queries are not free.
+    static void requestGpuTiming();
+    static bool isGpuTimingRequested();
+
+private:
+    quint64 m_frames = 0;
+    quint64 m_missedFrames = 0;
+    quint64 m_uploadedBytes = 0;
+    quint64 m_coalescedEvents = 0;
+    Histogram m_paintTimes;
+    Histogram m_gpuTimes;
+};
+
+QT_END_NAMESPACE
+
+#endif // FRAMESTATISTICS_H
@@ -1,14 +1,50 @@
-QT += dbus gui waylandcompositor
+QT += dbus gui gui-private waylandcompositor waylandcompositor-private
+
+CONFIG += link_pkgconfig wayland-scanner
+PKGCONFIG += egl wayland-client wayland-server
+
+WAYLAND_PROTOCOLS_DIR = $$system(pkg-config --variable=pkgdatadir wayland-protocols)
+WAYLANDSERVERSOURCES += \
+    $$WAYLAND_PROTOCOLS_DIR/stable/presentation-time/presentation-time.xml \
+    $$WAYLAND_PROTOCOLS_DIR/staging/fractional-scale/fractional-scale-v1.xml
+
+LIBS += -ldl
 
 HEADERS += \
     compositor.h \
     dbuscontainerstate.h \
+    dbusstatistics.h \
+    dbustrace.h \
+    fractionalscale.h \
+    framestatistics.h \
+    passthrough.h \
+    presentationtime.h \
+    renderer.h \
+    renderthread.h \
+    repaintscheduler.h \
+    textureatlas.h \
+    texturemanager.h \
+    touchresampler.h \
+    trace.h \
     view.h \
     window.h
 
 SOURCES += main.cpp \
     compositor.cpp \
     dbuscontainerstate.cpp \
+    dbusstatistics.cpp \
+    dbustrace.cpp \
+    fractionalscale.cpp \
+    framestatistics.cpp \
+    passthrough.cpp \
+    presentationtime.cpp \
+    renderer.cpp \
+    renderthread.cpp \
+    repaintscheduler.cpp \
+    textureatlas.cpp \
+    texturemanager.cpp \
+    touchresampler.cpp \
+    trace.cpp \
     view.cpp \
     window.cpp
 
@@ -26,15 +62,17 @@ xwayland {
     HEADERS += \
         xwayland.h \
         xwm.h \
+        xwmconnection.h \
         xwmwindow.h
 
     SOURCES += \
         xwayland.cpp \
         xwm.cpp \
+        xwmconnection.cpp \
         xwmwindow.cpp
 
     CONFIG += link_pkgconfig
-    PKGCONFIG += wayland-server xcb xcb-composite
+    PKGCONFIG += wayland-server xcb xcb-composite xcb-sync
 } else {
     message(Xwayland support disabled)
 }
@@ -0,0 +1,313 @@
+#include "passthrough.h"
+
+#include <QDebug>
+#include <QGuiApplication>
+#include <QImage>
+#include <QWindow>
+#include <qpa/qplatformnativeinterface.h>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+// Buffers are recycled as the host releases them, so a few are enough even
+// if the host holds on to one.
+static const int maxBuffers = 3;
+
+struct HostGlobals {
+    wl_display *display = nullptr;
+    wl_compositor *compositor = nullptr;
+    wl_subcompositor *subcompositor = nullptr;
+    wl_shm *shm = nullptr;
+};
+
+static void registryGlobal(void *data, wl_registry *registry, uint32_t name,
+                           const char *interface, uint32_t version)
+{
+    Q_UNUSED(version);
+    auto *globals = static_cast<HostGlobals *>(data);
+    if (::strcmp(interface, ::wl_subcompositor_interface.name) == 0) {
+        globals->subcompositor = static_cast<wl_subcompositor *>(
+                    ::wl_registry_bind(registry, name,
+                                       &::wl_subcompositor_interface, 1));
+    } else if (::strcmp(interface, ::wl_shm_interface.name) == 0) {
+        globals->shm = static_cast<wl_shm *>(
+                    ::wl_registry_bind(registry, name, &::wl_shm_interface, 1));
+    }
+}
+
+static void registryGlobalRemove(void *data, wl_registry *registry,
+                                 uint32_t name)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(registry);
+    Q_UNUSED(name);
+}
+
+static const wl_registry_listener registryListener = {
+    registryGlobal,
+    registryGlobalRemove
+};
+
+static HostGlobals *hostGlobals()
+{
+    static HostGlobals globals;
+    static bool initialized = false;
+    if (initialized) {
+        return &globals;
+    }
+    initialized = true;
+
+    if (!QGuiApplication::platformName().startsWith("wayland")) {
+        return &globals;
+    }
+    QPlatformNativeInterface *native = QGuiApplication::platformNativeInterface();
+    globals.display = static_cast<wl_display *>(
+                native->nativeResourceForIntegration("wl_display"));
+    globals.compositor = static_cast<wl_compositor *>(
+                native->nativeResourceForIntegration("compositor"));
+    if (!globals.display || !globals.compositor) {
+        return &globals;
+    }
+
+    // Bind the globals on a private queue so that the roundtrip does not
+    // dispatch events meant for Qt, then move them to the default queue
+    // that Qt dispatches.
+    wl_event_queue *queue = ::wl_display_create_queue(globals.display);
+    auto *wrapper = static_cast<wl_display *>(::wl_proxy_create_wrapper(globals.display));
+    ::wl_proxy_set_queue(reinterpret_cast<wl_proxy *>(wrapper), queue);
+    wl_registry *registry = ::wl_display_get_registry(wrapper);
+    ::wl_proxy_wrapper_destroy(wrapper);
+    ::wl_registry_add_listener(registry, &registryListener, &globals);
+    ::wl_display_roundtrip_queue(globals.display, queue);
+    ::wl_registry_destroy(registry);
+    if (globals.subcompositor) {
+        ::wl_proxy_set_queue(reinterpret_cast<wl_proxy *>(globals.subcompositor),
+                             nullptr);
+    }
+    if (globals.shm) {
+        ::wl_proxy_set_queue(reinterpret_cast<wl_proxy *>(globals.shm), nullptr);
+    }
+    ::wl_event_queue_destroy(queue);
+
+    if (globals.subcompositor && globals.shm) {
+        qInfo("Passthrough of client buffers to the host is available");
+    }
+    return &globals;
+}
+
+Passthrough::Passthrough(QWindow *window)
+    : QObject(window)
+    , m_parentSurface(hostSurface(window))
+{
+    HostGlobals *globals = hostGlobals();
+    Q_ASSERT(isSupported());
+    Q_ASSERT(m_parentSurface);
+    m_surface = ::wl_compositor_create_surface(globals->compositor);
+    m_subsurface = ::wl_subcompositor_get_subsurface(globals->subcompositor,
+                                                     m_surface,
+                                                     m_parentSurface);
+    // Let input go through to the host window.
+    wl_region *inputRegion = ::wl_compositor_create_region(globals->compositor);
+    ::wl_surface_set_input_region(m_surface, inputRegion);
+    ::wl_region_destroy(inputRegion);
+    ::wl_subsurface_set_sync(m_subsurface);
+}
+
+Passthrough::~Passthrough()
+{
+    if (m_frameCallback) {
+        ::wl_callback_destroy(m_frameCallback);
+    }
+    for (Buffer *buffer : qAsConst(m_buffers)) {
+        destroyBuffer(buffer);
+        delete buffer;
+    }
+    ::wl_subsurface_destroy(m_subsurface);
+    ::wl_surface_destroy(m_surface);
+}
+
+bool Passthrough::isSupported()
+{
+    HostGlobals *globals = hostGlobals();
+    return globals->subcompositor && globals->shm;
+}
+
+bool Passthrough::isSupportedFormat(const QImage &image)
+{
+    // These are all stored as XRGB8888, and the alpha channel is ignored
+    // since only opaque buffers are passed through.
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        return true;
+    default:
+        return false;
+    }
+}
+
+wl_surface *Passthrough::hostSurface(QWindow *window)
+{
+    QPlatformNativeInterface *native = QGuiApplication::platformNativeInterface();
+    return static_cast<wl_surface *>(native->nativeResourceForWindow("surface",
+                                                                     window));
+}
+
+bool Passthrough::present(const QImage &image, const QRegion &damage)
+{
+    Q_ASSERT(!isFramePending());
+    if (!isSupportedFormat(image)) {
+        return false;
+    }
+    for (Buffer *buffer : qAsConst(m_buffers)) {
+        buffer->damage += damage;
+    }
+    Buffer *buffer = freeBuffer(image.size());
+    if (!buffer) {
+        return false;
+    }
+
+    const QRegion copyRegion = buffer->damage & image.rect();
+    for (const QRect &rect : copyRegion) {
+        const int rowBytes = rect.width() * 4;
+        for (int y = rect.top(); y <= rect.bottom(); y++) {
+            ::memcpy(buffer->data + y * buffer->stride + rect.x() * 4,
+                     image.constScanLine(y) + rect.x() * 4, rowBytes);
+        }
+    }
+    buffer->damage = QRegion();
+    buffer->busy = true;
+
+    if (!m_active) {
+        ::wl_subsurface_set_desync(m_subsurface);
+        m_active = true;
+    }
+    ::wl_surface_attach(m_surface, buffer->buffer, 0, 0);
+    for (const QRect &rect : damage) {
+        ::wl_surface_damage(m_surface, rect.x(), rect.y(),
+                            rect.width(), rect.height());
+    }
+    static const wl_callback_listener frameCallbackListener = {
+        frameCallbackDone
+    };
+    m_frameCallback = ::wl_surface_frame(m_surface);
+    ::wl_callback_add_listener(m_frameCallback, &frameCallbackListener, this);
+    ::wl_surface_commit(m_surface);
+    ::wl_display_flush(hostGlobals()->display);
+    return true;
+}
+
+void Passthrough::stop()
+{
+    if (!m_active) {
+        return;
+    }
+    m_active = false;
+    // The frame may never be presented now, so don't wait for it.
+    if (m_frameCallback) {
+        ::wl_callback_destroy(m_frameCallback);
+        m_frameCallback = nullptr;
+    }
+    // In synchronized mode the subsurface is hidden together with the next
+    // frame composited in the host window, so nothing stale is shown.
+    ::wl_subsurface_set_sync(m_subsurface);
+    ::wl_surface_attach(m_surface, nullptr, 0, 0);
+    ::wl_surface_commit(m_surface);
+}
+
+Passthrough::Buffer *Passthrough::freeBuffer(const QSize &size)
+{
+    for (Buffer *buffer : qAsConst(m_buffers)) {
+        if (!buffer->busy) {
+            if (buffer->size != size) {
+                destroyBuffer(buffer);
+                if (!createBuffer(buffer, size)) {
+                    return nullptr;
+                }
+            }
+            return buffer;
+        }
+    }
+    if (m_buffers.size() >= maxBuffers) {
+        return nullptr;
+    }
+    auto *buffer = new Buffer;
+    if (!createBuffer(buffer, size)) {
+        delete buffer;
+        return nullptr;
+    }
+    m_buffers.append(buffer);
+    return buffer;
+}
+
+bool Passthrough::createBuffer(Buffer *buffer, const QSize &size)
+{
+    buffer->size = size;
+    buffer->stride = size.width() * 4;
+    buffer->byteSize = buffer->stride * size.height();
+    buffer->damage = QRect(QPoint(), size);
+    buffer->busy = false;
+
+    int fd = ::memfd_create("newcompositor-passthrough", MFD_CLOEXEC);
+    if (fd < 0) {
+        qWarning() << "error creating passthrough buffer:" << ::strerror(errno);
+        return false;
+    }
+    if (::ftruncate(fd, buffer->byteSize) != 0) {
+        qWarning() << "error resizing passthrough buffer:" << ::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    void *data = ::mmap(nullptr, buffer->byteSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        qWarning() << "error mapping passthrough buffer:" << ::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    buffer->data = static_cast<uchar *>(data);
+
+    static const wl_buffer_listener bufferListener = {
+        bufferRelease
+    };
+    wl_shm_pool *pool = ::wl_shm_create_pool(hostGlobals()->shm, fd,
+                                             buffer->byteSize);
+    buffer->buffer = ::wl_shm_pool_create_buffer(pool, 0, size.width(),
+                                                 size.height(), buffer->stride,
+                                                 WL_SHM_FORMAT_XRGB8888);
+    ::wl_buffer_add_listener(buffer->buffer, &bufferListener, buffer);
+    ::wl_shm_pool_destroy(pool);
+    ::close(fd);
+    return true;
+}
+
+void Passthrough::destroyBuffer(Buffer *buffer)
+{
+    if (buffer->buffer) {
+        ::wl_buffer_destroy(buffer->buffer);
+        buffer->buffer = nullptr;
+    }
+    if (buffer->data) {
+        ::munmap(buffer->data, buffer->byteSize);
+        buffer->data = nullptr;
+    }
+}
+
+void Passthrough::frameCallbackDone(void *data, wl_callback *callback,
+                                    uint32_t time)
+{
+    Q_UNUSED(time);
+    auto *passthrough = static_cast<Passthrough *>(data);
+    Q_ASSERT(passthrough->m_frameCallback == callback);
+    ::wl_callback_destroy(callback);
+    passthrough->m_frameCallback = nullptr;
+    emit passthrough->frameDone();
+}
+
+void Passthrough::bufferRelease(void *data, wl_buffer *buffer)
+{
+    Q_UNUSED(buffer);
+    static_cast<Buffer *>(data)->busy = false;
+}
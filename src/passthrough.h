@@ -0,0 +1,76 @@
+#ifndef PASSTHROUGH_H
+#define PASSTHROUGH_H
+
+#include <QObject>
+#include <QRegion>
+#include <QSize>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+
+class QImage;
+class QWindow;
+struct wl_buffer;
+struct wl_callback;
+struct wl_subsurface;
+struct wl_surface;
+
+// Shows client buffers on a subsurface of the host window, bypassing
+// composition. Only usable when the host is a Wayland compositor.
+class Passthrough : public QObject
+{
+    Q_OBJECT
+public:
+    Passthrough(QWindow *window);
+    ~Passthrough();
+
+    static bool isSupported();
+    static bool isSupportedFormat(const QImage &image);
+
+    // The host surface the subsurface was created for. The host surface is
+    // recreated when the window is hidden and shown again.
+    static wl_surface *hostSurface(QWindow *window);
+    wl_surface *parentSurface() const { return m_parentSurface; }
+
+    bool isActive() const { return m_active; }
+    bool isFramePending() const { return m_frameCallback != nullptr; }
+
+    // Damage is in buffer coordinates, relative to the previous image.
+    bool present(const QImage &image, const QRegion &damage);
+    // Hides the subsurface on the next commit of the host window.
+    void stop();
+
+signals:
+    void frameDone();
+
+private:
+    struct Buffer {
+        wl_buffer *buffer = nullptr;
+        uchar *data = nullptr;
+        int byteSize = 0;
+        int stride = 0;
+        QSize size;
+        bool busy = false;
+        // Damage since the contents of this buffer were last updated.
+        QRegion damage;
+    };
+
+    static void frameCallbackDone(void *data, wl_callback *callback,
+                                  uint32_t time);
+    static void bufferRelease(void *data, wl_buffer *buffer);
+
+    Buffer *freeBuffer(const QSize &size);
+    bool createBuffer(Buffer *buffer, const QSize &size);
+    void destroyBuffer(Buffer *buffer);
+
+    wl_surface *m_parentSurface = nullptr;
+    wl_surface *m_surface = nullptr;
+    wl_subsurface *m_subsurface = nullptr;
+    wl_callback *m_frameCallback = nullptr;
+    QVector<Buffer *> m_buffers;
+    bool m_active = false;
+};
+
+QT_END_NAMESPACE
+
+#endif // PASSTHROUGH_H
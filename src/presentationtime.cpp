@@ -0,0 +1,120 @@
+#include "presentationtime.h"
+
+#include <QWaylandClient>
+#include <QWaylandCompositor>
+#include <QWaylandOutput>
+#include <QWaylandSurface>
+#include <time.h>
+
+PresentationFeedback::PresentationFeedback(struct ::wl_client *client,
+                                           uint32_t id, int version)
+    : QtWaylandServer::wp_presentation_feedback(client, id, version)
+{
+}
+
+void PresentationFeedback::sendPresented(QWaylandOutput *output,
+                                         quint64 timestamp, quint32 refresh,
+                                         quint64 sequence, quint32 flags)
+{
+    if (output) {
+        QWaylandClient *client = QWaylandClient::fromWlClient(
+                    output->compositor(), resource()->client());
+        struct ::wl_resource *outputResource = output->resourceForClient(client);
+        if (outputResource) {
+            send_sync_output(outputResource);
+        }
+    }
+    const quint64 seconds = timestamp / 1000000000;
+    send_presented(seconds >> 32, seconds & 0xffffffff,
+                   timestamp % 1000000000, refresh,
+                   sequence >> 32, sequence & 0xffffffff, flags);
+    wl_resource_destroy(resource()->handle);
+}
+
+void PresentationFeedback::sendDiscarded()
+{
+    send_discarded();
+    wl_resource_destroy(resource()->handle);
+}
+
+void PresentationFeedback::wp_presentation_feedback_destroy_resource(Resource *resource)
+{
+    Q_UNUSED(resource);
+    delete this;
+}
+
+PresentationTime::PresentationTime(QWaylandCompositor *compositor)
+    : QWaylandCompositorExtensionTemplate<PresentationTime>(compositor)
+    , m_compositor(compositor)
+{
+}
+
+void PresentationTime::initialize()
+{
+    QWaylandCompositorExtensionTemplate::initialize();
+    init(m_compositor->display(), 1);
+}
+
+quint64 PresentationTime::now()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return quint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void PresentationTime::wp_presentation_bind_resource(Resource *resource)
+{
+    send_clock_id(resource->handle, CLOCK_MONOTONIC);
+}
+
+void PresentationTime::wp_presentation_feedback(Resource *resource,
+                                                struct ::wl_resource *surfaceResource,
+                                                uint32_t callback)
+{
+    QWaylandSurface *surface = QWaylandSurface::fromResource(surfaceResource);
+    auto *feedback = new PresentationFeedback(resource->client(), callback,
+                                              wl_resource_get_version(resource->handle));
+    if (!surface) {
+        feedback->sendDiscarded();
+        return;
+    }
+    connect(surface, &QWaylandSurface::redraw,
+            this, &PresentationTime::onSurfaceCommitted,
+            Qt::UniqueConnection);
+    connect(surface, &QWaylandSurface::surfaceDestroyed,
+            this, &PresentationTime::onSurfaceDestroyed,
+            Qt::UniqueConnection);
+    m_pendingFeedback[surface].append(feedback);
+}
+
+PresentationFeedbackList PresentationTime::takeFeedback(QWaylandSurface *surface)
+{
+    return m_committedFeedback.take(surface);
+}
+
+void PresentationTime::onSurfaceCommitted()
+{
+    auto *surface = qobject_cast<QWaylandSurface *>(sender());
+    const PresentationFeedbackList pending = m_pendingFeedback.take(surface);
+    // Contents that were never part of a frame have been replaced.
+    discard(m_committedFeedback.take(surface));
+    if (!pending.isEmpty()) {
+        m_committedFeedback.insert(surface, pending);
+    }
+}
+
+void PresentationTime::onSurfaceDestroyed()
+{
+    auto *surface = qobject_cast<QWaylandSurface *>(sender());
+    discard(m_pendingFeedback.take(surface));
+    discard(m_committedFeedback.take(surface));
+}
+
+void PresentationTime::discard(const PresentationFeedbackList &feedbackList)
+{
+    for (PresentationFeedback *feedback : feedbackList) {
+        if (feedback) {
+            feedback->sendDiscarded();
+        }
+    }
+}
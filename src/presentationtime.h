@@ -0,0 +1,73 @@
+#ifndef PRESENTATIONTIME_H
+#define PRESENTATIONTIME_H
+
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QVector>
+#include <QWaylandCompositorExtensionTemplate>
+
+#include "qwayland-server-presentation-time.h"
+
+QT_BEGIN_NAMESPACE
+
+class QWaylandCompositor;
+class QWaylandOutput;
+class QWaylandSurface;
+
+class PresentationFeedback : public QObject,
+                             public QtWaylandServer::wp_presentation_feedback
+{
+    Q_OBJECT
+public:
+    PresentationFeedback(struct ::wl_client *client, uint32_t id,
+                         int version);
+
+    void sendPresented(QWaylandOutput *output, quint64 timestamp,
+                       quint32 refresh, quint64 sequence, quint32 flags);
+    void sendDiscarded();
+
+protected:
+    void wp_presentation_feedback_destroy_resource(Resource *resource) override;
+};
+
+typedef QVector<QPointer<PresentationFeedback>> PresentationFeedbackList;
+
+class PresentationTime
+        : public QWaylandCompositorExtensionTemplate<PresentationTime>
+        , public QtWaylandServer::wp_presentation
+{
+    Q_OBJECT
+public:
+    PresentationTime(QWaylandCompositor *compositor);
+    void initialize() override;
+
+    // Takes the feedback for the contents last committed to the surface,
+    // when they become part of a frame.
+    PresentationFeedbackList takeFeedback(QWaylandSurface *surface);
+
+    static quint64 now();
+
+protected:
+    void wp_presentation_bind_resource(Resource *resource) override;
+    void wp_presentation_feedback(Resource *resource,
+                                  struct ::wl_resource *surface,
+                                  uint32_t callback) override;
+
+private slots:
+    void onSurfaceCommitted();
+    void onSurfaceDestroyed();
+
+private:
+    static void discard(const PresentationFeedbackList &feedbackList);
+
+    QWaylandCompositor *m_compositor;
+    // Feedback requested for the next commit, and for the last commit
+    // that was not yet part of a frame.
+    QHash<QWaylandSurface *, PresentationFeedbackList> m_pendingFeedback;
+    QHash<QWaylandSurface *, PresentationFeedbackList> m_committedFeedback;
+};
+
+QT_END_NAMESPACE
+
+#endif // PRESENTATIONTIME_H
@@ -0,0 +1,499 @@
+#include "renderer.h"
+
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QPointF>
+
+#include "trace.h"
+
+#include <algorithm>
+
+#include <dlfcn.h>
+#define MESA_EGL_NO_X11_HEADERS
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// Number of previous frames whose damage is remembered. Buffers older than
+// this are repainted in full.
+static const int maxBufferAge = 4;
+
+// Buffer damage of windows is passed to the host through the
+// eglSwapBuffers() wrapper in libnewcompositorhacks, if it is loaded.
+typedef void (*SetSwapDamageFunc)(EGLSurface surface, const EGLint *rects,
+                                  EGLint nRects);
+
+static const char backgroundVertexShader[] =
+        "attribute highp vec2 vertexCoord;\n"
+        "void main() {\n"
+        "    gl_Position = vec4(vertexCoord, 0.0, 1.0);\n"
+        "}\n";
+
+// Same as filling white with Qt::Dense4Pattern: every other pixel is black.
+static const char backgroundFragmentShader[] =
+        "#ifdef GL_ES\n"
+        "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+        "precision highp float;\n"
+        "#else\n"
+        "precision mediump float;\n"
+        "#endif\n"
+        "#endif\n"
+        "void main() {\n"
+        "    float white = mod(floor(gl_FragCoord.x) + floor(gl_FragCoord.y), 2.0);\n"
+        "    gl_FragColor = vec4(white, white, white, 1.0);\n"
+        "}\n";
+
+static const char textureVertexShader[] =
+        "attribute highp vec2 vertexCoord;\n"
+        "attribute highp vec2 textureCoord;\n"
+        "varying highp vec2 uv;\n"
+        "void main() {\n"
+        "    uv = textureCoord;\n"
+        "    gl_Position = vec4(vertexCoord, 0.0, 1.0);\n"
+        "}\n";
+
+static const char textureFragmentShader[] =
+        "#ifdef GL_ES\n"
+        "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+        "precision highp float;\n"
+        "#else\n"
+        "precision mediump float;\n"
+        "#endif\n"
+        "#endif\n"
+        "varying vec2 uv;\n"
+        "uniform sampler2D source;\n"
+        "void main() {\n"
+        "    gl_FragColor = texture2D(source, uv);\n"
+        "}\n";
+
+static const char externalFragmentShader[] =
+        "#extension GL_OES_EGL_image_external : require\n"
+        "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+        "precision highp float;\n"
+        "#else\n"
+        "precision mediump float;\n"
+        "#endif\n"
+        "varying vec2 uv;\n"
+        "uniform samplerExternalOES source;\n"
+        "void main() {\n"
+        "    gl_FragColor = texture2D(source, uv);\n"
+        "}\n";
+
+#ifndef GL_TEXTURE_EXTERNAL_OES
+#define GL_TEXTURE_EXTERNAL_OES 0x8D65
+#endif
+
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT_EXT
+#define GL_QUERY_RESULT_EXT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE_EXT
+#define GL_QUERY_RESULT_AVAILABLE_EXT 0x8867
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+typedef void (QOPENGLF_APIENTRYP GenQueriesFunc)(GLsizei n, GLuint *ids);
+typedef void (QOPENGLF_APIENTRYP DeleteQueriesFunc)(GLsizei n, const GLuint *ids);
+typedef void (QOPENGLF_APIENTRYP BeginQueryFunc)(GLenum target, GLuint id);
+typedef void (QOPENGLF_APIENTRYP EndQueryFunc)(GLenum target);
+typedef void (QOPENGLF_APIENTRYP GetQueryObjectuivFunc)(GLuint id, GLenum pname,
+                                                       GLuint *params);
+typedef void (QOPENGLF_APIENTRYP GetQueryObjectui64vFunc)(GLuint id, GLenum pname,
+                                                         quint64 *params);
+
+// Position and texture coordinates.
+static const int vertexSize = 4;
+static const int quadVertexCount = 6;
+
+static bool linkProgram(QOpenGLShaderProgram *program,
+                        const char *vertexShader, const char *fragmentShader)
+{
+    program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShader);
+    program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShader);
+    program->bindAttributeLocation("vertexCoord", 0);
+    program->bindAttributeLocation("textureCoord", 1);
+    if (!program->link()) {
+        qWarning() << "error linking shader:" << program->log();
+        return false;
+    }
+    return true;
+}
+
+static QRect toEglRect(const QRect &rect, const QSize &size)
+{
+    // EGL and GL rects have their origin at the bottom left.
+    return QRect(rect.x(), size.height() - rect.y() - rect.height(),
+                 rect.width(), rect.height());
+}
+
+void Renderer::initialize()
+{
+    linkProgram(&m_backgroundProgram, backgroundVertexShader,
+                backgroundFragmentShader);
+    if (linkProgram(&m_textureProgram, textureVertexShader,
+                    textureFragmentShader)) {
+        m_textureProgram.bind();
+        m_textureProgram.setUniformValue("source", 0);
+        m_textureProgram.release();
+    }
+    m_vertices.setUsagePattern(QOpenGLBuffer::StreamDraw);
+    m_vertices.create();
+    initializeTimerQueries();
+
+    EGLDisplay display = ::eglGetCurrentDisplay();
+    if (display == EGL_NO_DISPLAY) {
+        return;
+    }
+    const QByteArray extensions = ::eglQueryString(display, EGL_EXTENSIONS);
+    const QList<QByteArray> extensionList = extensions.split(' ');
+    m_hasBufferAge = (extensionList.contains("EGL_EXT_buffer_age") ||
+                      extensionList.contains("EGL_KHR_partial_update"));
+    if (extensionList.contains("EGL_KHR_partial_update")) {
+        m_setDamageRegion = ::eglGetProcAddress("eglSetDamageRegionKHR");
+    }
+    if (extensionList.contains("EGL_KHR_swap_buffers_with_damage") ||
+            extensionList.contains("EGL_EXT_swap_buffers_with_damage")) {
+        m_setSwapDamage = reinterpret_cast<QFunctionPointer>(
+                    ::dlsym(RTLD_DEFAULT, "newcompositor_set_swap_damage"));
+    }
+}
+
+void Renderer::cleanup()
+{
+    m_backgroundProgram.removeAllShaders();
+    m_textureProgram.removeAllShaders();
+    delete m_externalProgram;
+    m_externalProgram = nullptr;
+    m_externalProgramFailed = false;
+    m_vertices.destroy();
+    m_damageHistory.clear();
+    if (m_deleteQueries && m_timerQueries[0]) {
+        auto deleteQueries = reinterpret_cast<DeleteQueriesFunc>(m_deleteQueries);
+        deleteQueries(maxTimerQueries, m_timerQueries);
+        m_timerQueries[0] = 0;
+    }
+}
+
+void Renderer::initializeTimerQueries()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    QByteArray suffix;
+    if (context->isOpenGLES()) {
+        if (!context->hasExtension("GL_EXT_disjoint_timer_query")) {
+            return;
+        }
+        suffix = "EXT";
+    } else if (context->format().version() < qMakePair(3, 3) &&
+               !context->hasExtension("GL_ARB_timer_query")) {
+        return;
+    }
+    m_genQueries = context->getProcAddress("glGenQueries" + suffix);
+    m_deleteQueries = context->getProcAddress("glDeleteQueries" + suffix);
+    m_beginQuery = context->getProcAddress("glBeginQuery" + suffix);
+    m_endQuery = context->getProcAddress("glEndQuery" + suffix);
+    m_getQueryObjectuiv = context->getProcAddress("glGetQueryObjectuiv" + suffix);
+    m_getQueryObjectui64v = context->getProcAddress("glGetQueryObjectui64v" + suffix);
+    if (!m_genQueries || !m_deleteQueries || !m_beginQuery || !m_endQuery ||
+            !m_getQueryObjectuiv || !m_getQueryObjectui64v) {
+        m_genQueries = nullptr;
+    }
+}
+
+void Renderer::beginTimerQuery()
+{
+    if (!m_genQueries || m_pendingQueries == maxTimerQueries) {
+        return;
+    }
+    if (!m_timerQueries[0]) {
+        reinterpret_cast<GenQueriesFunc>(m_genQueries)(maxTimerQueries,
+                                                       m_timerQueries);
+    }
+    reinterpret_cast<BeginQueryFunc>(m_beginQuery)(GL_TIME_ELAPSED_EXT,
+                                                   m_timerQueries[m_nextQuery]);
+    m_queryActive = true;
+}
+
+void Renderer::endTimerQuery()
+{
+    if (m_queryActive) {
+        reinterpret_cast<EndQueryFunc>(m_endQuery)(GL_TIME_ELAPSED_EXT);
+        m_queryActive = false;
+        m_nextQuery = (m_nextQuery + 1) % maxTimerQueries;
+        m_pendingQueries++;
+    }
+    if (!m_pendingQueries) {
+        return;
+    }
+
+    // Only the oldest query is polled, which keeps one result per frame.
+    const int query = ((m_nextQuery - m_pendingQueries + maxTimerQueries) %
+                       maxTimerQueries);
+    GLuint available = 0;
+    reinterpret_cast<GetQueryObjectuivFunc>(m_getQueryObjectuiv)(
+                m_timerQueries[query], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+    if (!available) {
+        return;
+    }
+    quint64 elapsed = 0;
+    reinterpret_cast<GetQueryObjectui64vFunc>(m_getQueryObjectui64v)(
+                m_timerQueries[query], GL_QUERY_RESULT_EXT, &elapsed);
+    m_pendingQueries--;
+
+    // Results are meaningless if the GPU was reset or changed frequency
+    // meanwhile.
+    GLint disjoint = 0;
+    if (QOpenGLContext::currentContext()->isOpenGLES()) {
+        QOpenGLContext::currentContext()->functions()->glGetIntegerv(GL_GPU_DISJOINT_EXT,
+                                                                     &disjoint);
+    }
+    if (!disjoint) {
+        m_gpuTime = qint64(elapsed);
+    }
+}
+
+qint64 Renderer::takeGpuTime()
+{
+    const qint64 gpuTime = m_gpuTime;
+    m_gpuTime = -1;
+    return gpuTime;
+}
+
+QOpenGLShaderProgram *Renderer::programFor(const Batch &batch)
+{
+    if (!batch.textureId) {
+        return &m_backgroundProgram;
+    }
+    if (batch.target != GL_TEXTURE_EXTERNAL_OES) {
+        return &m_textureProgram;
+    }
+    if (!m_externalProgram && !m_externalProgramFailed) {
+        m_externalProgram = new QOpenGLShaderProgram;
+        if (linkProgram(m_externalProgram, textureVertexShader,
+                        externalFragmentShader)) {
+            m_externalProgram->bind();
+            m_externalProgram->setUniformValue("source", 0);
+            m_externalProgram->release();
+        } else {
+            delete m_externalProgram;
+            m_externalProgram = nullptr;
+            m_externalProgramFailed = true;
+        }
+    }
+    return m_externalProgram;
+}
+
+void Renderer::addQuads(const QRegion &region, const QSize &size,
+                        const RenderItem *item, bool blend)
+{
+    if (region.isEmpty()) {
+        return;
+    }
+    const GLuint textureId = item ? item->textureId : 0;
+    const GLenum target = item ? item->target : GLenum(GL_TEXTURE_2D);
+    if (m_batches.isEmpty() || m_batches.last().textureId != textureId ||
+            m_batches.last().target != target ||
+            m_batches.last().blend != blend) {
+        m_batches.append({textureId, target, blend,
+                          m_vertexData.size() / vertexSize, 0});
+    }
+    Batch &batch = m_batches.last();
+
+    const float xScale = 2.0f / size.width();
+    const float yScale = 2.0f / size.height();
+    for (const QRect &rect : region) {
+        // Two triangles, in window coordinates.
+        const QPointF corners[quadVertexCount] = {
+            rect.topLeft(), rect.topRight() + QPoint(1, 0),
+            rect.bottomLeft() + QPoint(0, 1),
+            rect.bottomLeft() + QPoint(0, 1), rect.topRight() + QPoint(1, 0),
+            rect.bottomRight() + QPoint(1, 1)
+        };
+        for (const QPointF &corner : corners) {
+            const QPointF textureCoord = item ? item->textureTransform.map(corner)
+                                              : QPointF();
+            m_vertexData << corner.x() * xScale - 1.0f
+                         << 1.0f - corner.y() * yScale
+                         << textureCoord.x() << textureCoord.y();
+        }
+        batch.count += quadVertexCount;
+    }
+}
+
+QRegion Renderer::repaintRegion(const RenderFrame &frame)
+{
+    EGLint age = 0;
+    if (m_hasBufferAge) {
+        EGLDisplay display = ::eglGetCurrentDisplay();
+        EGLSurface surface = ::eglGetCurrentSurface(EGL_DRAW);
+        if (!::eglQuerySurface(display, surface, EGL_BUFFER_AGE_EXT, &age)) {
+            age = 0;
+        }
+    }
+
+    const QRect viewportRect(QPoint(), frame.size);
+    QRegion region;
+    if (age <= 0 || age > m_damageHistory.size() + 1) {
+        // Contents of the buffer are undefined.
+        region = viewportRect;
+    } else {
+        region = frame.damage;
+        for (int i = 0; i < age - 1; i++) {
+            region += m_damageHistory.at(i);
+        }
+        region &= viewportRect;
+    }
+
+    m_damageHistory.prepend(frame.damage);
+    if (m_damageHistory.size() > maxBufferAge) {
+        m_damageHistory.resize(maxBufferAge);
+    }
+
+    // Each rect costs a pass over the scene, so merge them when there are
+    // too many.
+    if (region.rectCount() > 4) {
+        region = region.boundingRect();
+    }
+
+    if (m_setDamageRegion && !region.isEmpty()) {
+        QVector<EGLint> rects;
+        for (const QRect &r : region) {
+            const QRect eglRect = toEglRect(r, frame.size);
+            rects << eglRect.x() << eglRect.y()
+                  << eglRect.width() << eglRect.height();
+        }
+        auto setDamageRegion = reinterpret_cast<PFNEGLSETDAMAGEREGIONKHRPROC>(m_setDamageRegion);
+        setDamageRegion(::eglGetCurrentDisplay(),
+                        ::eglGetCurrentSurface(EGL_DRAW),
+                        rects.data(), region.rectCount());
+    }
+
+    return region;
+}
+
+void Renderer::setSwapDamage(const QRegion &region, const QSize &size)
+{
+    if (!m_setSwapDamage) {
+        return;
+    }
+    QVector<EGLint> rects;
+    for (const QRect &r : region) {
+        const QRect eglRect = toEglRect(r, size);
+        rects << eglRect.x() << eglRect.y()
+              << eglRect.width() << eglRect.height();
+    }
+    auto setSwapDamage = reinterpret_cast<SetSwapDamageFunc>(m_setSwapDamage);
+    setSwapDamage(::eglGetCurrentSurface(EGL_DRAW), rects.constData(),
+                  region.rectCount());
+}
+
+void Renderer::render(const RenderFrame &frame)
+{
+    TraceSpan span("render");
+    QOpenGLFunctions *functions = QOpenGLContext::currentContext()->functions();
+
+    const QRegion region = repaintRegion(frame);
+
+    m_vertexData.resize(0);
+    m_batches.resize(0);
+
+    // The background is below everything, so it can be drawn first,
+    // wherever the views leave it uncovered.
+    addQuads(region - frame.covered, frame.size, nullptr, false);
+
+    // What is visible of opaque views does not overlap, so they can be drawn
+    // in any order, grouped by texture, and without blending. Views that are
+    // not fully opaque follow in stacking order.
+    QVector<const RenderItem *> opaqueItems;
+    opaqueItems.reserve(frame.items.size());
+    for (const RenderItem &item : frame.items) {
+        if (item.opaque) {
+            opaqueItems.append(&item);
+        }
+    }
+    std::stable_sort(opaqueItems.begin(), opaqueItems.end(),
+                     [](const RenderItem *a, const RenderItem *b) {
+        return (a->target < b->target ||
+                (a->target == b->target && a->textureId < b->textureId));
+    });
+    for (const RenderItem *item : qAsConst(opaqueItems)) {
+        addQuads(item->visibleRegion & region, frame.size, item, false);
+    }
+    for (const RenderItem &item : frame.items) {
+        if (!item.opaque) {
+            addQuads(item.visibleRegion & region, frame.size, &item, true);
+        }
+    }
+
+    if (frame.measureGpuTime) {
+        beginTimerQuery();
+    }
+
+    if (!m_batches.isEmpty()) {
+        functions->glViewport(0, 0, frame.size.width(), frame.size.height());
+        functions->glActiveTexture(GL_TEXTURE0);
+        functions->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        m_vertices.bind();
+        m_vertices.allocate(m_vertexData.constData(),
+                            m_vertexData.size() * int(sizeof(GLfloat)));
+
+        QOpenGLShaderProgram *currentProgram = nullptr;
+        bool blending = false;
+        for (const Batch &batch : qAsConst(m_batches)) {
+            QOpenGLShaderProgram *program = programFor(batch);
+            if (!program) {
+                continue;
+            }
+            if (program != currentProgram) {
+                if (currentProgram) {
+                    currentProgram->disableAttributeArray(1);
+                }
+                currentProgram = program;
+                program->bind();
+                program->enableAttributeArray(0);
+                program->setAttributeBuffer(0, GL_FLOAT, 0, 2,
+                                            vertexSize * sizeof(GLfloat));
+                if (batch.textureId) {
+                    program->enableAttributeArray(1);
+                    program->setAttributeBuffer(1, GL_FLOAT,
+                                                2 * sizeof(GLfloat), 2,
+                                                vertexSize * sizeof(GLfloat));
+                }
+            }
+            if (batch.textureId) {
+                functions->glBindTexture(batch.target, batch.textureId);
+            }
+            if (blending != batch.blend) {
+                blending = batch.blend;
+                if (blending) {
+                    functions->glEnable(GL_BLEND);
+                } else {
+                    functions->glDisable(GL_BLEND);
+                }
+            }
+            functions->glDrawArrays(GL_TRIANGLES, batch.first, batch.count);
+        }
+
+        if (currentProgram) {
+            currentProgram->disableAttributeArray(0);
+            currentProgram->disableAttributeArray(1);
+            currentProgram->release();
+        }
+        if (blending) {
+            functions->glDisable(GL_BLEND);
+        }
+        m_vertices.release();
+    }
+
+    // Also polls for the results of earlier frames.
+    endTimerQuery();
+
+    // The host only needs what changed since the last frame, not what was
+    // repainted to bring an older buffer up to date.
+    setSwapDamage(frame.damage & QRect(QPoint(), frame.size), frame.size);
+}
@@ -0,0 +1,113 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <QOpenGLBuffer>
+#include <QOpenGLShaderProgram>
+#include <QRect>
+#include <QRegion>
+#include <QSize>
+#include <QTransform>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+
+// What is drawn of a view in a frame.
+struct RenderItem
+{
+    GLuint textureId;
+    GLenum target;
+    // Maps window coordinates to texture coordinates.
+    QTransform textureTransform;
+    QRect rect;
+    QRegion visibleRegion;
+    bool opaque;
+};
+
+// Snapshot of the scene of a window, taken on the main thread, from which
+// a frame can be drawn without touching the compositor.
+struct RenderFrame
+{
+    QSize size;
+    // Damage since the previous frame.
+    QRegion damage;
+    // Covered by the opaque parts of the views.
+    QRegion covered;
+    // Bottom to top.
+    QVector<RenderItem> items;
+    bool measureGpuTime = false;
+    // Signaled once the textures were uploaded, when the frame is drawn in
+    // another context than the one they were uploaded with.
+    GLsync uploadFence = nullptr;
+};
+
+// Draws frames into the surface of the context current on the calling
+// thread. The quads of all views and of the background are put in one
+// vertex buffer, and drawn with a call per run of quads sharing a texture.
+class Renderer
+{
+public:
+    void initialize();
+    void cleanup();
+
+    void render(const RenderFrame &frame);
+    // GPU time of an earlier frame that has become available, in
+    // nanoseconds, or -1.
+    qint64 takeGpuTime();
+
+private:
+    struct Batch
+    {
+        // No texture for the background.
+        GLuint textureId;
+        GLenum target;
+        bool blend;
+        int first;
+        int count;
+    };
+
+    QRegion repaintRegion(const RenderFrame &frame);
+    void setSwapDamage(const QRegion &region, const QSize &size);
+    void addQuads(const QRegion &region, const QSize &size,
+                  const RenderItem *item, bool blend);
+    QOpenGLShaderProgram *programFor(const Batch &batch);
+    void initializeTimerQueries();
+    void beginTimerQuery();
+    void endTimerQuery();
+
+    QOpenGLShaderProgram m_backgroundProgram;
+    QOpenGLShaderProgram m_textureProgram;
+    QOpenGLShaderProgram *m_externalProgram = nullptr;
+    bool m_externalProgramFailed = false;
+    QOpenGLBuffer m_vertices;
+    // Reused from frame to frame.
+    QVector<GLfloat> m_vertexData;
+    QVector<Batch> m_batches;
+
+    // Damage of previous frames (most recent first) for repainting buffers
+    // by their age.
+    QVector<QRegion> m_damageHistory;
+    bool m_hasBufferAge = false;
+    QFunctionPointer m_setDamageRegion = nullptr;
+    QFunctionPointer m_setSwapDamage = nullptr;
+
+    // Timer queries of GL_EXT_disjoint_timer_query or GL_ARB_timer_query,
+    // as a ring of the frames in flight on the GPU.
+    static const int maxTimerQueries = 4;
+    QFunctionPointer m_genQueries = nullptr;
+    QFunctionPointer m_deleteQueries = nullptr;
+    QFunctionPointer m_beginQuery = nullptr;
+    QFunctionPointer m_endQuery = nullptr;
+    QFunctionPointer m_getQueryObjectuiv = nullptr;
+    QFunctionPointer m_getQueryObjectui64v = nullptr;
+    GLuint m_timerQueries[maxTimerQueries] = {};
+    // Queries are issued at m_nextQuery, and m_pendingQueries of them,
+    // before it, have no result read yet.
+    int m_nextQuery = 0;
+    int m_pendingQueries = 0;
+    bool m_queryActive = false;
+    qint64 m_gpuTime = -1;
+};
+
+QT_END_NAMESPACE
+
+#endif // RENDERER_H
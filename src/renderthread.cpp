@@ -0,0 +1,92 @@
+#include "renderthread.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QWindow>
+
+#include "trace.h"
+
+#ifndef GL_TIMEOUT_IGNORED
+#define GL_TIMEOUT_IGNORED 0xFFFFFFFFFFFFFFFFull
+#endif
+
+RenderThread::RenderThread(QWindow *window)
+    : QObject(window)
+    , m_window(window)
+    , m_worker(new QObject)
+{
+    m_thread.setObjectName(QStringLiteral("render"));
+    m_worker->moveToThread(&m_thread);
+    m_thread.start();
+}
+
+RenderThread::~RenderThread()
+{
+    QMetaObject::invokeMethod(m_worker, [this] { cleanup(); },
+                              Qt::BlockingQueuedConnection);
+    m_thread.quit();
+    m_thread.wait();
+    delete m_worker;
+}
+
+bool RenderThread::isEnabled()
+{
+    return (qEnvironmentVariableIntValue("NEWCOMPOSITOR_RENDER_THREAD") &&
+            QOpenGLContext::supportsThreadedOpenGL());
+}
+
+void RenderThread::render(const RenderFrame &frame)
+{
+    QMetaObject::invokeMethod(m_worker, [this, frame] { renderFrame(frame); },
+                              Qt::QueuedConnection);
+}
+
+void RenderThread::renderFrame(const RenderFrame &frame)
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (!m_context) {
+        m_context = new QOpenGLContext;
+        m_context->setShareContext(QOpenGLContext::globalShareContext());
+        m_context->setFormat(m_window->requestedFormat());
+        if (!m_context->create() || !m_context->makeCurrent(m_window)) {
+            qWarning() << "could not create render thread context";
+            delete m_context;
+            m_context = nullptr;
+            emit frameSwapped(0, -1);
+            return;
+        }
+        m_renderer.initialize();
+    } else if (!m_context->makeCurrent(m_window)) {
+        emit frameSwapped(0, -1);
+        return;
+    }
+    if (frame.uploadFence) {
+        // Waits on the GPU, not here.
+        QOpenGLExtraFunctions *functions = m_context->extraFunctions();
+        functions->glWaitSync(frame.uploadFence, 0, GL_TIMEOUT_IGNORED);
+        functions->glDeleteSync(frame.uploadFence);
+    }
+    m_renderer.render(frame);
+    const qint64 renderTime = timer.nsecsElapsed();
+    {
+        TraceSpan span("swapBuffers");
+        m_context->swapBuffers(m_window);
+    }
+    emit frameSwapped(renderTime, m_renderer.takeGpuTime());
+}
+
+void RenderThread::cleanup()
+{
+    if (!m_context) {
+        return;
+    }
+    if (m_context->makeCurrent(m_window)) {
+        m_renderer.cleanup();
+        m_context->doneCurrent();
+    }
+    delete m_context;
+    m_context = nullptr;
+}
@@ -0,0 +1,50 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QObject>
+#include <QThread>
+
+#include "renderer.h"
+
+QT_BEGIN_NAMESPACE
+
+class QOpenGLContext;
+class QWindow;
+
+// Draws and swaps the frames of a window on a thread of its own, with a
+// context of its own, so that a slow swap does not hold up input and
+// protocol handling on the main thread.
+class RenderThread : public QObject
+{
+    Q_OBJECT
+public:
+    RenderThread(QWindow *window);
+    ~RenderThread();
+
+    // Enabled by setting NEWCOMPOSITOR_RENDER_THREAD=1.
+    static bool isEnabled();
+
+    // The textures in the frame must stay valid until frameSwapped().
+    void render(const RenderFrame &frame);
+
+signals:
+    // Time spent drawing the frame, and the GPU time of an earlier frame
+    // or -1, in nanoseconds.
+    void frameSwapped(qint64 renderTime, qint64 gpuTime);
+
+private:
+    void renderFrame(const RenderFrame &frame);
+    void cleanup();
+
+    QWindow *m_window;
+    QThread m_thread;
+    // Lives in m_thread, for queueing work to it.
+    QObject *m_worker;
+    // Only used in m_thread.
+    QOpenGLContext *m_context = nullptr;
+    Renderer m_renderer;
+};
+
+QT_END_NAMESPACE
+
+#endif // RENDERTHREAD_H
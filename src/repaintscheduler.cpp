@@ -0,0 +1,108 @@
+#include "repaintscheduler.h"
+
+#include <QScreen>
+#include <QWindow>
+#include <algorithm>
+
+#include "presentationtime.h"
+
+static const int maxSamples = 16;
+// Time for the swap and for the host to pick up the frame, on top of the
+// time spent painting.
+static const qint64 repaintMargin = 2000000;
+static const qint64 minRepaintLead = 3000000;
+
+RepaintScheduler::RepaintScheduler(QWindow *window)
+    : QObject(window)
+    , m_window(window)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout,
+            this, &RepaintScheduler::repaint);
+    m_intervals.reserve(maxSamples);
+    m_paintTimes.reserve(maxSamples);
+}
+
+void RepaintScheduler::schedule()
+{
+    if (m_timer.isActive()) {
+        return;
+    }
+    const qint64 now = PresentationTime::now();
+    const qint64 period = refreshPeriod();
+    const qint64 lead = repaintLead();
+    if (m_lastPresentation == 0 || now - m_lastPresentation > 4 * period) {
+        // Idle for a while, there is no refresh to align to.
+        emit repaint();
+        return;
+    }
+    qint64 refresh = m_lastPresentation + period;
+    while (refresh - lead < now) {
+        refresh += period;
+    }
+    m_timer.start(int((refresh - lead - now) / 1000000));
+}
+
+void RepaintScheduler::addPaintTime(qint64 paintTime)
+{
+    if (m_paintTimes.size() < maxSamples) {
+        m_paintTimes.append(paintTime);
+    } else {
+        m_paintTimes[m_nextPaintTime] = paintTime;
+    }
+    m_nextPaintTime = (m_nextPaintTime + 1) % maxSamples;
+}
+
+void RepaintScheduler::framePresented(qint64 timestamp)
+{
+    if (m_lastPresentation) {
+        const qint64 interval = timestamp - m_lastPresentation;
+        // Longer intervals are idle time, not refreshes.
+        if (interval > 0 && interval < 4 * nominalRefreshPeriod()) {
+            if (m_intervals.size() < maxSamples) {
+                m_intervals.append(interval);
+            } else {
+                m_intervals[m_nextInterval] = interval;
+            }
+            m_nextInterval = (m_nextInterval + 1) % maxSamples;
+        }
+    }
+    m_lastPresentation = timestamp;
+}
+
+qint64 RepaintScheduler::nominalRefreshPeriod() const
+{
+    QScreen *screen = m_window->screen();
+    if (screen && screen->refreshRate() > 1) {
+        return qint64(1000000000 / screen->refreshRate());
+    }
+    return 1000000000 / 60;
+}
+
+qint64 RepaintScheduler::refreshPeriod() const
+{
+    const qint64 nominal = nominalRefreshPeriod();
+    if (m_intervals.size() < 4) {
+        return nominal;
+    }
+    QVector<qint64> intervals = m_intervals;
+    std::nth_element(intervals.begin(),
+                     intervals.begin() + intervals.size() / 2,
+                     intervals.end());
+    const qint64 median = intervals.at(intervals.size() / 2);
+    // Frames that took longer than a refresh make the intervals a multiple
+    // of the period. Shorter intervals mean the host refreshes faster than
+    // the screen reports, e.g. with variable refresh rates.
+    const qint64 refreshes = qMax<qint64>(1, (median + nominal / 2) / nominal);
+    return median / refreshes;
+}
+
+qint64 RepaintScheduler::repaintLead() const
+{
+    qint64 paintTime = 0;
+    for (qint64 time : m_paintTimes) {
+        paintTime = qMax(paintTime, time);
+    }
+    return qBound(minRepaintLead, paintTime + repaintMargin, refreshPeriod());
+}
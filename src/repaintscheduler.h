@@ -0,0 +1,53 @@
+#ifndef REPAINTSCHEDULER_H
+#define REPAINTSCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+
+class QWindow;
+
+// Starts composition of a window as late as it can while still making the
+// next host refresh, predicted from the times previous frames were
+// presented.
+class RepaintScheduler : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(qint64 refreshPeriod READ refreshPeriod)
+    Q_PROPERTY(qint64 repaintLead READ repaintLead)
+public:
+    RepaintScheduler(QWindow *window);
+
+    void schedule();
+
+    // Time from starting the composition of a frame to handing it to the
+    // swap, in nanoseconds.
+    void addPaintTime(qint64 paintTime);
+    void framePresented(qint64 timestamp);
+
+    // In nanoseconds.
+    qint64 refreshPeriod() const;
+    qint64 repaintLead() const;
+
+signals:
+    void repaint();
+
+private:
+    qint64 nominalRefreshPeriod() const;
+
+    QWindow *m_window;
+    QTimer m_timer;
+    qint64 m_lastPresentation = 0;
+    // Recent intervals between presentations and paint durations, as ring
+    // buffers.
+    QVector<qint64> m_intervals;
+    int m_nextInterval = 0;
+    QVector<qint64> m_paintTimes;
+    int m_nextPaintTime = 0;
+};
+
+QT_END_NAMESPACE
+
+#endif // REPAINTSCHEDULER_H
@@ -0,0 +1,114 @@
+#include "textureatlas.h"
+
+#include <QByteArray>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLTexture>
+
+#include "renderthread.h"
+#include "texturemanager.h"
+
+static const int atlasSize = 1024;
+static const int cellSize = 32;
+static const int cellsPerSide = atlasSize / cellSize;
+static const int maxSize = 256;
+
+TextureAtlas *TextureAtlas::instance()
+{
+    // All contexts of the compositor share their textures, so a single
+    // atlas serves every window.
+    static TextureAtlas *atlas = nullptr;
+    if (!atlas) {
+        atlas = new TextureAtlas;
+    }
+    return atlas;
+}
+
+bool TextureAtlas::isEnabled()
+{
+    static const bool enabled = !RenderThread::isEnabled();
+    return enabled;
+}
+
+bool TextureAtlas::fits(const QSize &size)
+{
+    return (!size.isEmpty() && size.width() <= maxSize &&
+            size.height() <= maxSize);
+}
+
+TextureAtlas::TextureAtlas()
+    : m_texture(TextureManager::instance()->createTexture(QSize(atlasSize,
+                                                                atlasSize)))
+    , m_cells(cellsPerSide * cellsPerSide)
+{
+    // Filtering at the edges of the surfaces samples the gaps between them,
+    // which must be transparent.
+    const QByteArray zeros(atlasSize * atlasSize * 4, 0);
+    QOpenGLFunctions *functions = QOpenGLContext::currentContext()->functions();
+    m_texture->bind();
+    functions->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    functions->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, atlasSize, atlasSize,
+                               GL_RGBA, GL_UNSIGNED_BYTE, zeros.constData());
+    m_texture->release();
+}
+
+QRectF TextureAtlas::sourceRect(const QRect &rect) const
+{
+    return QRectF(qreal(rect.x()) / atlasSize, qreal(rect.y()) / atlasSize,
+                  qreal(rect.width()) / atlasSize,
+                  qreal(rect.height()) / atlasSize);
+}
+
+QRect TextureAtlas::cellsFor(const QRect &rect) const
+{
+    // A pixel is left free after each surface, for filtering.
+    return QRect(rect.x() / cellSize, rect.y() / cellSize,
+                 (rect.width() + cellSize) / cellSize,
+                 (rect.height() + cellSize) / cellSize);
+}
+
+QRect TextureAtlas::allocate(const QSize &size)
+{
+    if (!fits(size)) {
+        return QRect();
+    }
+    const QRect cellRect = cellsFor(QRect(QPoint(), size));
+    for (int y = 0; y <= cellsPerSide - cellRect.height(); y++) {
+        for (int x = 0; x <= cellsPerSide - cellRect.width(); x++) {
+            bool free = true;
+            for (int j = y; free && j < y + cellRect.height(); j++) {
+                for (int i = x; i < x + cellRect.width(); i++) {
+                    if (m_cells.testBit(j * cellsPerSide + i)) {
+                        free = false;
+                        // Skip past the allocated cell.
+                        x = i;
+                        break;
+                    }
+                }
+            }
+            if (!free) {
+                continue;
+            }
+            for (int j = y; j < y + cellRect.height(); j++) {
+                for (int i = x; i < x + cellRect.width(); i++) {
+                    m_cells.setBit(j * cellsPerSide + i);
+                }
+            }
+            return QRect(QPoint(x * cellSize, y * cellSize), size);
+        }
+    }
+    return QRect();
+}
+
+void TextureAtlas::release(const QRect &rect)
+{
+    if (rect.isNull()) {
+        return;
+    }
+    const QRect cellRect = cellsFor(rect);
+    for (int j = cellRect.top(); j <= cellRect.bottom(); j++) {
+        for (int i = cellRect.left(); i <= cellRect.right(); i++) {
+            m_cells.clearBit(j * cellsPerSide + i);
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H
+
+#include <QBitArray>
+#include <QRect>
+#include <QRectF>
+#include <QSize>
+
+QT_BEGIN_NAMESPACE
+
+class QOpenGLTexture;
+
+// Shared texture that small shared memory surfaces are packed into, so
+// that menus, tooltips and the like do not each need a texture, and can
+// be drawn together.
+class TextureAtlas
+{
+public:
+    // The atlas of the contexts sharing with the current one.
+    static TextureAtlas *instance();
+
+    // Not with render threads, which could draw from the atlas while
+    // another window uploads to it.
+    static bool isEnabled();
+    static bool fits(const QSize &size);
+
+    QOpenGLTexture *texture() const { return m_texture; }
+    // Normalized texture coordinates of a rect of the atlas.
+    QRectF sourceRect(const QRect &rect) const;
+
+    // Returns a null rect when the atlas is full.
+    QRect allocate(const QSize &size);
+    void release(const QRect &rect);
+
+private:
+    TextureAtlas();
+
+    QRect cellsFor(const QRect &rect) const;
+
+    QOpenGLTexture *m_texture;
+    // Allocated cells, row by row.
+    QBitArray m_cells;
+};
+
+QT_END_NAMESPACE
+
+#endif // TEXTUREATLAS_H
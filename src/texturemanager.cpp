@@ -0,0 +1,121 @@
+#include "texturemanager.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLTexture>
+#include <QSocketNotifier>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Stalls of 150 ms within 2 s, the shortest window unprivileged processes
+// can watch.
+static const char defaultPressureTrigger[] = "some 150000 2000000";
+
+TextureManager *TextureManager::instance()
+{
+    static TextureManager *manager = nullptr;
+    if (!manager) {
+        manager = new TextureManager;
+    }
+    return manager;
+}
+
+TextureManager::TextureManager()
+{
+    watchMemoryPressure();
+}
+
+void TextureManager::watchMemoryPressure()
+{
+    // A trigger of /proc/pressure/memory, or empty to not watch it.
+    QByteArray trigger = defaultPressureTrigger;
+    if (qEnvironmentVariableIsSet("NEWCOMPOSITOR_MEMORY_PRESSURE")) {
+        trigger = qgetenv("NEWCOMPOSITOR_MEMORY_PRESSURE");
+    }
+    if (trigger.isEmpty()) {
+        return;
+    }
+    const int fd = ::open("/proc/pressure/memory",
+                          O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        qInfo() << "not watching memory pressure:" << ::strerror(errno);
+        return;
+    }
+    // With the terminating null.
+    if (::write(fd, trigger.constData(), trigger.size() + 1) < 0) {
+        qWarning() << "error setting memory pressure trigger" << trigger
+                   << ::strerror(errno);
+        ::close(fd);
+        return;
+    }
+    // The kernel signals the trigger with POLLPRI, which Qt calls an
+    // exception.
+    m_pressureNotifier = new QSocketNotifier(fd, QSocketNotifier::Exception,
+                                             this);
+    connect(m_pressureNotifier, &QSocketNotifier::activated,
+            this, &TextureManager::memoryPressure);
+}
+
+QOpenGLTexture *TextureManager::createTexture(const QSize &size)
+{
+    auto *texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (context->isOpenGLES() && context->format().majorVersion() < 3) {
+        // Unsized internal formats are required without texture storage.
+        texture->setFormat(QOpenGLTexture::RGBAFormat);
+    } else {
+        texture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    }
+    texture->setSize(size.width(), size.height());
+    texture->setMipLevels(1);
+    texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+    texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    // Immutable storage is used when the context supports it.
+    texture->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+    m_textureBytes += qint64(size.width()) * size.height() * 4;
+    return texture;
+}
+
+void TextureManager::destroyTexture(QOpenGLTexture *texture)
+{
+    if (!texture) {
+        return;
+    }
+    m_textureBytes -= qint64(texture->width()) * texture->height() * 4;
+    if (!ensureContext()) {
+        qWarning("leaking a texture with no context to free it in");
+    }
+    delete texture;
+}
+
+bool TextureManager::makeCurrent()
+{
+    if (!m_context) {
+        m_context = new QOpenGLContext;
+        m_context->setShareContext(QOpenGLContext::globalShareContext());
+        if (!m_context->create()) {
+            qWarning() << "could not create offscreen context";
+            delete m_context;
+            m_context = nullptr;
+            return false;
+        }
+        m_surface = new QOffscreenSurface;
+        m_surface->setFormat(m_context->format());
+        m_surface->create();
+    }
+    return m_context->makeCurrent(m_surface);
+}
+
+bool TextureManager::ensureContext()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (context && QOpenGLContext::areSharing(
+                context, QOpenGLContext::globalShareContext())) {
+        return true;
+    }
+    return makeCurrent();
+}
@@ -0,0 +1,58 @@
+#ifndef TEXTUREMANAGER_H
+#define TEXTUREMANAGER_H
+
+#include <QObject>
+#include <QSize>
+
+QT_BEGIN_NAMESPACE
+
+class QOffscreenSurface;
+class QOpenGLContext;
+class QOpenGLTexture;
+class QSocketNotifier;
+
+// Creates and frees the textures of the compositor itself, as opposed to
+// those of client buffers, which QtWaylandCompositor owns, so that they are
+// freed in a context sharing them whenever their owners let go of them.
+// It also watches the memory pressure of the system, upon which the
+// textures of views that are not shown are dropped.
+class TextureManager : public QObject
+{
+    Q_OBJECT
+public:
+    // All contexts of the compositor share their textures, so a single
+    // manager serves every window.
+    static TextureManager *instance();
+
+    // An RGBA texture with storage of the size, made with a context sharing
+    // with the windows current.
+    QOpenGLTexture *createTexture(const QSize &size);
+    // Can be called with no context current.
+    void destroyTexture(QOpenGLTexture *texture);
+    qint64 textureBytes() const { return m_textureBytes; }
+
+    // Makes current an offscreen context sharing with the windows, for
+    // when no window can be drawn to.
+    bool makeCurrent();
+    // Makes the offscreen context current, unless a context sharing with
+    // the windows already is.
+    bool ensureContext();
+
+signals:
+    // Set up with NEWCOMPOSITOR_MEMORY_PRESSURE.
+    void memoryPressure();
+
+private:
+    TextureManager();
+    void watchMemoryPressure();
+
+    qint64 m_textureBytes = 0;
+    QSocketNotifier *m_pressureNotifier = nullptr;
+
+    QOpenGLContext *m_context = nullptr;
+    QOffscreenSurface *m_surface = nullptr;
+};
+
+QT_END_NAMESPACE
+
+#endif // TEXTUREMANAGER_H
@@ -0,0 +1,90 @@
+#include "touchresampler.h"
+
+// Extrapolation beyond the prediction, from the last host event to the
+// time the motion is sent, is limited to about half a refresh so that a
+// finger that stopped does not overshoot by much.
+static const qint64 maxResampleDelay = Q_INT64_C(8000000);
+static const qint64 maxPrediction = Q_INT64_C(20000000);
+
+TouchResampler::TouchResampler()
+{
+    const qint64 prediction = qEnvironmentVariableIntValue("NEWCOMPOSITOR_TOUCH_PREDICTION");
+    m_prediction = qBound<qint64>(0, prediction * 1000000, maxPrediction);
+    bool ok;
+    const qreal smoothing = qEnvironmentVariable("NEWCOMPOSITOR_TOUCH_SMOOTHING").toDouble(&ok);
+    m_smoothing = (ok ? qBound<qreal>(0, smoothing, 0.95) : 0.5);
+}
+
+bool TouchResampler::isEnabled()
+{
+    static const bool enabled = qEnvironmentVariableIntValue("NEWCOMPOSITOR_TOUCH_RESAMPLING");
+    return enabled;
+}
+
+void TouchResampler::press(int id, const QPointF &position, ulong timestamp,
+                           qint64 time)
+{
+    release(id);
+    m_points.append({id, position, QPointF(), timestamp, time});
+}
+
+void TouchResampler::move(int id, const QPointF &position, ulong timestamp,
+                          qint64 time)
+{
+    Point *point = find(id);
+    if (!point) {
+        press(id, position, timestamp, time);
+        return;
+    }
+    // The host timestamps are used for the velocity, as events can arrive
+    // in bursts.
+    if (timestamp > point->timestamp) {
+        const QPointF velocity = ((position - point->position) /
+                                  (qreal(timestamp - point->timestamp) * 1000000));
+        point->velocity = (point->velocity * m_smoothing +
+                           velocity * (1 - m_smoothing));
+    }
+    point->position = position;
+    point->timestamp = timestamp;
+    point->time = time;
+}
+
+void TouchResampler::release(int id)
+{
+    for (int i = 0; i < m_points.size(); i++) {
+        if (m_points.at(i).id == id) {
+            m_points.remove(i);
+            return;
+        }
+    }
+}
+
+QPointF TouchResampler::resample(int id, qint64 time) const
+{
+    const Point *point = find(id);
+    if (!point) {
+        return QPointF();
+    }
+    const qint64 delay = qBound<qint64>(0, time - point->time, maxResampleDelay);
+    return point->position + point->velocity * qreal(delay + m_prediction);
+}
+
+TouchResampler::Point *TouchResampler::find(int id)
+{
+    for (Point &point : m_points) {
+        if (point.id == id) {
+            return &point;
+        }
+    }
+    return nullptr;
+}
+
+const TouchResampler::Point *TouchResampler::find(int id) const
+{
+    for (const Point &point : m_points) {
+        if (point.id == id) {
+            return &point;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,53 @@
+#ifndef TOUCHRESAMPLER_H
+#define TOUCHRESAMPLER_H
+
+#include <QPointF>
+#include <QVarLengthArray>
+
+QT_BEGIN_NAMESPACE
+
+// Estimates where touch points are at the time their motion is sent to
+// clients, once a frame, instead of wherever the last host event left
+// them, and optionally a little ahead of it to hide some of the latency.
+// Velocities are smoothed so that noise is not extrapolated.
+class TouchResampler
+{
+public:
+    TouchResampler();
+
+    // Enabled by setting NEWCOMPOSITOR_TOUCH_RESAMPLING=1. The prediction
+    // is set in milliseconds with NEWCOMPOSITOR_TOUCH_PREDICTION, and the
+    // weight of the previous velocity, from 0 to 1, with
+    // NEWCOMPOSITOR_TOUCH_SMOOTHING.
+    static bool isEnabled();
+
+    // Times are in nanoseconds of the monotonic clock, except for the
+    // timestamps of the host events, in milliseconds.
+    void press(int id, const QPointF &position, ulong timestamp, qint64 time);
+    void move(int id, const QPointF &position, ulong timestamp, qint64 time);
+    void release(int id);
+
+    QPointF resample(int id, qint64 time) const;
+
+private:
+    struct Point
+    {
+        int id;
+        QPointF position;
+        // In pixels per nanosecond.
+        QPointF velocity;
+        ulong timestamp;
+        qint64 time;
+    };
+
+    Point *find(int id);
+    const Point *find(int id) const;
+
+    qint64 m_prediction;
+    qreal m_smoothing;
+    QVarLengthArray<Point, 10> m_points;
+};
+
+QT_END_NAMESPACE
+
+#endif // TOUCHRESAMPLER_H
@@ -0,0 +1,156 @@
+#include "trace.h"
+
+#include <QCoreApplication>
+#include <QWaylandClient>
+#include <QWaylandSurface>
+#include <atomic>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+
+struct TraceEvent
+{
+    // Index of the event plus one once written, so that readers can tell
+    // events that are being overwritten.
+    QAtomicInteger<quint64> sequence;
+    const char *name;
+    qint64 timestamp;
+    // Duration of spans, or value of counters.
+    qint64 value;
+    quint32 id;
+    quint32 clientId;
+    int threadId;
+    char phase;
+};
+
+static const int maxEvents = 1 << 16;
+
+// Zero initialized, so untouched pages cost no memory while tracing is
+// disabled.
+static TraceEvent events[maxEvents];
+static QAtomicInteger<quint64> nextEvent;
+
+QAtomicInteger<int> Trace::m_enabled(qEnvironmentVariableIntValue("NEWCOMPOSITOR_TRACE"));
+
+void Trace::setEnabled(bool enabled)
+{
+    m_enabled.storeRelaxed(enabled);
+}
+
+qint64 Trace::now()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void Trace::record(const char *name, char phase, qint64 timestamp,
+                   qint64 value, quint32 id, quint32 clientId)
+{
+    static thread_local const int threadId = int(::syscall(SYS_gettid));
+
+    const quint64 index = nextEvent.fetchAndAddRelaxed(1);
+    TraceEvent &event = events[index % maxEvents];
+    event.sequence.storeRelaxed(0);
+    // Readers must not see the new fields with the old sequence.
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name = name;
+    event.timestamp = timestamp;
+    event.value = value;
+    event.id = id;
+    event.clientId = clientId;
+    event.threadId = threadId;
+    event.phase = phase;
+    event.sequence.storeRelease(index + 1);
+}
+
+static QByteArray toMicroseconds(qint64 nsecs)
+{
+    return QByteArray::number(double(nsecs) / 1000.0, 'f', 3);
+}
+
+QByteArray Trace::toJson()
+{
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    const quint64 end = nextEvent.loadAcquire();
+    const quint64 begin = (end > quint64(maxEvents) ? end - maxEvents : 0);
+
+    QByteArray json("{\"traceEvents\":[");
+    bool first = true;
+    for (quint64 index = begin; index < end; index++) {
+        const TraceEvent &event = events[index % maxEvents];
+        if (event.sequence.loadAcquire() != index + 1) {
+            continue;
+        }
+        const TraceEvent copy = {{}, event.name, event.timestamp, event.value,
+                                 event.id, event.clientId, event.threadId,
+                                 event.phase};
+        // The copy must be done before the sequence is checked again.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (event.sequence.loadRelaxed() != index + 1) {
+            // Overwritten while being copied.
+            continue;
+        }
+
+        if (!first) {
+            json += ',';
+        }
+        first = false;
+        json += "\n{\"name\":\"";
+        json += copy.name;
+        json += "\",\"ph\":\"";
+        json += copy.phase;
+        json += "\",\"ts\":";
+        json += toMicroseconds(copy.timestamp);
+        json += ",\"pid\":";
+        json += pid;
+        json += ",\"tid\":";
+        json += QByteArray::number(copy.threadId);
+        if (copy.phase == 'C') {
+            json += ",\"args\":{\"value\":";
+            json += QByteArray::number(copy.value);
+            json += '}';
+        } else {
+            json += ",\"dur\":";
+            json += toMicroseconds(copy.value);
+            if (copy.id || copy.clientId) {
+                json += ",\"args\":{\"id\":";
+                json += QByteArray::number(copy.id);
+                json += ",\"client\":";
+                json += QByteArray::number(copy.clientId);
+                json += '}';
+            }
+        }
+        json += '}';
+    }
+    json += "\n]}\n";
+    return json;
+}
+
+void TraceSpan::start(const char *name, quint32 id, quint32 clientId)
+{
+    m_name = name;
+    m_id = id;
+    m_clientId = clientId;
+    m_start = Trace::now();
+}
+
+void TraceSpan::start(const char *name, QWaylandSurface *surface)
+{
+    quint32 id = 0;
+    quint32 clientId = 0;
+    if (surface && surface->resource()) {
+        id = ::wl_resource_get_id(surface->resource());
+    }
+    if (surface && surface->client()) {
+        clientId = quint32(surface->client()->processId());
+    }
+    start(name, id, clientId);
+}
+
+void TraceSpan::finish()
+{
+    const qint64 end = Trace::now();
+    Trace::record(m_name, 'X', m_start, end - m_start, m_id, m_clientId);
+}
@@ -0,0 +1,82 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QAtomicInteger>
+#include <QByteArray>
+
+QT_BEGIN_NAMESPACE
+
+class QWaylandSurface;
+
+// Spans and counters on the hot paths, recorded into a fixed ring buffer
+// when enabled, and exported in the Chrome trace event format that
+// Perfetto and chrome://tracing read. When disabled, a span costs a
+// relaxed load.
+class Trace
+{
+public:
+    static bool isEnabled() { return m_enabled.loadRelaxed(); }
+    // Enabled at startup by setting NEWCOMPOSITOR_TRACE=1.
+    static void setEnabled(bool enabled);
+
+    // Names must be string literals, as only the pointers are kept.
+    static void counter(const char *name, qint64 value)
+    {
+        if (isEnabled()) {
+            record(name, 'C', now(), value, 0, 0);
+        }
+    }
+
+    // The most recent events, as JSON.
+    static QByteArray toJson();
+
+private:
+    friend class TraceSpan;
+
+    static qint64 now();
+    static void record(const char *name, char phase, qint64 timestamp,
+                       qint64 value, quint32 id, quint32 clientId);
+
+    static QAtomicInteger<int> m_enabled;
+};
+
+// Records the time from its construction to its destruction.
+class TraceSpan
+{
+public:
+    TraceSpan(const char *name, quint32 id = 0, quint32 clientId = 0)
+    {
+        if (Trace::isEnabled()) {
+            start(name, id, clientId);
+        }
+    }
+    // Tagged with the ids of the surface and of the process of its client.
+    TraceSpan(const char *name, QWaylandSurface *surface)
+    {
+        if (Trace::isEnabled()) {
+            start(name, surface);
+        }
+    }
+    ~TraceSpan()
+    {
+        if (m_name) {
+            finish();
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+
+    void start(const char *name, quint32 id, quint32 clientId);
+    void start(const char *name, QWaylandSurface *surface);
+    void finish();
+
+    const char *m_name = nullptr;
+    qint64 m_start;
+    quint32 m_id;
+    quint32 m_clientId;
+};
+
+QT_END_NAMESPACE
+
+#endif // TRACE_H
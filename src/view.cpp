@@ -50,85 +50,340 @@
 
 #include "view.h"
 
+#include <QGuiApplication>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
 #include <QOpenGLTexture>
+#include <QScreen>
 #include <QWaylandBufferRef>
 #include <QWaylandOutput>
+#include <QWaylandSeat>
 #include <QWaylandSurface>
 #include <QWaylandWlShellSurface>
 #include <QWaylandXdgPopup>
 #include <QWaylandXdgToplevel>
+#include <QtWaylandCompositor/private/qwaylandsurface_p.h>
 
 #include "compositor.h"
+#include "textureatlas.h"
+#include "texturemanager.h"
+#include "trace.h"
 #include "window.h"
 #ifdef XWAYLAND
 #include "xwmwindow.h"
 #endif
 
+#ifndef GL_UNPACK_ROW_LENGTH
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#endif
+
+// Buffers updated in this many frames in a row are moved out of the
+// texture atlas.
+static const int maxAtlasContentUpdates = 8;
+
 View::View(Compositor *compositor, QWaylandSurface *surface)
     : m_compositor(compositor)
 {
     setSurface(surface);
     connect(surface, &QWaylandSurface::offsetForNextFrame,
             this, &View::onOffsetForNextFrame);
+    connect(surface, &QWaylandSurface::damaged,
+            this, &View::onSurfaceDamaged);
+    connect(surface, &QWaylandSurface::redraw,
+            this, &View::onSurfaceRedraw);
     connect(surface, &QWaylandSurface::surfaceDestroyed,
             this, &QObject::deleteLater);
 }
 
 View::~View()
 {
-    if (m_shmTexture) {
-        delete m_shmTexture;
+    TextureManager::instance()->destroyTexture(m_shmTexture);
+    if (!m_atlasRect.isNull()) {
+        TextureAtlas::instance()->release(m_atlasRect);
     }
 }
 
 QOpenGLTexture *View::getTexture()
 {
-    bool newContent = advance();
+    bool newContent = advance() || m_textureStale;
+    m_textureStale = false;
     QWaylandBufferRef buf = currentBuffer();
     if (newContent) {
-        m_texture = buf.toOpenGLTexture();
-        // QWaylandBufferRef::toOpenGLTexture() calls
-        // WaylandEglClientBufferIntegrationPrivate::deleteOrphanedTextures()
-        // so it is now safe to delete windows.
-        Window::deletePendingWindows();
-        // XXX: Textures don't work right when format is not GL_RGBA.
-        if (m_texture && m_texture->format() != QOpenGLTexture::RGBAFormat) {
-            if (buf.isSharedMemory()) {
-                if (!m_shmTexture) {
-                    m_shmTexture = new QOpenGLTexture(QOpenGLTexture::Target2D);
-                }
-                m_shmTexture->destroy();
-                // QOpenGLTexture::setData() converts the image to
-                // adequate format.
-                m_shmTexture->setData(buf.image(),
-                                      QOpenGLTexture::DontGenerateMipMaps);
-                m_texture = m_shmTexture;
+        TraceSpan span("getTexture", surface());
+        m_contentUpdates = qMin(m_contentUpdates + 1, maxAtlasContentUpdates);
+        if (buf.isSharedMemory()) {
+            m_texture = uploadShmBuffer(buf);
+        } else {
+            if (!m_atlasRect.isNull()) {
+                TextureAtlas::instance()->release(m_atlasRect);
+                m_atlasRect = QRect();
             }
+            m_texture = buf.toOpenGLTexture();
         }
-        if (surface()) {
-            switch (buf.origin()) {
-            case QWaylandSurface::OriginTopLeft:
-                m_origin = QOpenGLTextureBlitter::OriginTopLeft;
-                break;
-            case QWaylandSurface::OriginBottomLeft:
-                m_origin = QOpenGLTextureBlitter::OriginBottomLeft;
-                break;
-            }
+        updateBufferState(buf);
+    } else {
+        m_contentUpdates = 0;
+        if (!buf.hasContent()) {
+            m_texture = nullptr;
         }
-    } else if (!buf.hasContent()) {
-        m_texture = nullptr;
     }
     return m_texture;
 }
 
+void View::releaseTexture()
+{
+    if (!m_shmTexture && m_atlasRect.isNull()) {
+        return;
+    }
+    TextureManager::instance()->destroyTexture(m_shmTexture);
+    m_shmTexture = nullptr;
+    if (!m_atlasRect.isNull()) {
+        TextureAtlas::instance()->release(m_atlasRect);
+        m_atlasRect = QRect();
+    }
+    // Uploaded again in full when the view is drawn next.
+    m_texture = nullptr;
+    m_textureStale = true;
+}
+
+void View::updateBufferState(const QWaylandBufferRef &buf)
+{
+    if (buf.isSharedMemory()) {
+        m_bufferHasAlpha = buf.image().hasAlphaChannel();
+    } else {
+        m_bufferHasAlpha = (buf.bufferFormatEgl() !=
+                            QWaylandBufferRef::BufferFormat_RGB);
+    }
+    if (surface()) {
+        switch (buf.origin()) {
+        case QWaylandSurface::OriginTopLeft:
+            m_origin = QOpenGLTextureBlitter::OriginTopLeft;
+            break;
+        case QWaylandSurface::OriginBottomLeft:
+            m_origin = QOpenGLTextureBlitter::OriginBottomLeft;
+            break;
+        }
+    }
+}
+
+QOpenGLTexture *View::uploadShmBuffer(const QWaylandBufferRef &buf)
+{
+    // QWaylandBufferRef::toOpenGLTexture() reallocates and uploads the whole
+    // buffer on every commit. Instead, keep a texture of the buffer size and
+    // only upload what the client damaged since the last upload.
+    const QImage image = buf.image();
+    if (image.isNull()) {
+        return nullptr;
+    }
+    const QRect imageRect = image.rect();
+
+    // Small buffers that do not change every frame go to the atlas.
+    const bool useAtlas = (TextureAtlas::isEnabled() &&
+                           TextureAtlas::fits(image.size()) &&
+                           m_contentUpdates < maxAtlasContentUpdates);
+    if (!m_atlasRect.isNull() &&
+            (!useAtlas || m_atlasRect.size() != image.size())) {
+        TextureAtlas::instance()->release(m_atlasRect);
+        m_atlasRect = QRect();
+        m_shmDamage = imageRect;
+    }
+    if (useAtlas && m_atlasRect.isNull()) {
+        m_atlasRect = TextureAtlas::instance()->allocate(image.size());
+        if (!m_atlasRect.isNull()) {
+            TextureManager::instance()->destroyTexture(m_shmTexture);
+            m_shmTexture = nullptr;
+            m_shmDamage = imageRect;
+        }
+    }
+
+    QOpenGLTexture *texture;
+    if (!m_atlasRect.isNull()) {
+        texture = TextureAtlas::instance()->texture();
+    } else {
+        if (!m_shmTexture || m_shmTexture->width() != image.width() ||
+                m_shmTexture->height() != image.height()) {
+            TextureManager::instance()->destroyTexture(m_shmTexture);
+            m_shmTexture = TextureManager::instance()->createTexture(image.size());
+            m_shmDamage = imageRect;
+        }
+        texture = m_shmTexture;
+    }
+
+    const QRegion damage = m_shmDamage & imageRect;
+    m_shmDamage = QRegion();
+    if (!damage.isEmpty()) {
+        QOpenGLFunctions *functions = QOpenGLContext::currentContext()->functions();
+        texture->bind();
+        functions->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        for (const QRect &rect : damage) {
+            uploadShmRect(image, rect, m_atlasRect.topLeft());
+        }
+        texture->release();
+    }
+    return texture;
+}
+
+void View::uploadShmRect(const QImage &image, const QRect &rect,
+                         const QPoint &offset)
+{
+    m_uploadedBytes += qint64(rect.width()) * rect.height() * 4;
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    QOpenGLFunctions *functions = context->functions();
+    const bool hasUnpackRowLength = (!context->isOpenGLES() ||
+                                     context->format().majorVersion() >= 3 ||
+                                     context->hasExtension("GL_EXT_unpack_subimage"));
+    if (hasUnpackRowLength && (image.format() == QImage::Format_RGBA8888 ||
+                               image.format() == QImage::Format_RGBX8888)) {
+        // Already in the texture format, upload straight from the buffer.
+        functions->glPixelStorei(GL_UNPACK_ROW_LENGTH,
+                                 image.bytesPerLine() / 4);
+        functions->glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x() + offset.x(),
+                                   rect.y() + offset.y(),
+                                   rect.width(), rect.height(),
+                                   GL_RGBA, GL_UNSIGNED_BYTE,
+                                   image.constScanLine(rect.y()) + rect.x() * 4);
+        functions->glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    } else {
+        // Only the damaged part is converted. Rows of RGBA8888 images are
+        // always tightly packed.
+        const QImage converted = image.copy(rect).convertToFormat(QImage::Format_RGBA8888);
+        functions->glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x() + offset.x(),
+                                   rect.y() + offset.y(),
+                                   rect.width(), rect.height(),
+                                   GL_RGBA, GL_UNSIGNED_BYTE,
+                                   converted.constBits());
+    }
+}
+
+QRegion View::opaqueRegion() const
+{
+    QWaylandSurface *surface = this->surface();
+    if (!surface) {
+        return QRegion();
+    }
+    const QRect rect(QPoint(), surfaceSize());
+    if (!m_bufferHasAlpha) {
+        return rect;
+    }
+    return QWaylandSurfacePrivate::get(surface)->opaqueRegion & rect;
+}
+
 QOpenGLTextureBlitter::Origin View::textureOrigin() const
 {
     return m_origin;
 }
 
-void View::onOutputGeometryChanged()
+int View::bufferRotation() const
+{
+    // QtWaylandCompositor only keeps the buffer transform as an orientation
+    // relative to the primary screen, and drops flips.
+    QWaylandSurface *surface = this->surface();
+    if (!surface) {
+        return 0;
+    }
+    const bool isPortrait = (QGuiApplication::primaryScreen()->primaryOrientation() ==
+                             Qt::PortraitOrientation);
+    switch (surface->contentOrientation()) {
+    case Qt::PortraitOrientation:
+        return (isPortrait ? 0 : 90);
+    case Qt::LandscapeOrientation:
+        return (isPortrait ? 270 : 0);
+    case Qt::InvertedPortraitOrientation:
+        return (isPortrait ? 180 : 270);
+    case Qt::InvertedLandscapeOrientation:
+        return (isPortrait ? 90 : 180);
+    default:
+        return 0;
+    }
+}
+
+QSize View::surfaceSize() const
+{
+    QWaylandSurface *surface = this->surface();
+    if (!surface) {
+        return QSize();
+    }
+    // Without a viewport, QtWaylandCompositor sizes the surface by its
+    // buffer, ignoring the buffer transform.
+    QSize size = surface->destinationSize();
+    const QSizeF bufferSize = QSizeF(surface->bufferSize()) / surface->bufferScale();
+    if (bufferRotation() % 180 != 0 && QSizeF(size) == bufferSize &&
+            surface->sourceGeometry() == QRectF(QPointF(), bufferSize)) {
+        size.transpose();
+    }
+    return size;
+}
+
+QTransform View::surfaceToBuffer() const
+{
+    // The source rect of wp_viewporter is scaled to the surface size, i.e.
+    // the destination size, and is in buffer coordinates after the buffer
+    // transform and scale.
+    QWaylandSurface *surface = this->surface();
+    const QSizeF destSize = surfaceSize();
+    const int rotation = bufferRotation();
+    const QSizeF bufferSize = QSizeF(surface->bufferSize()) / surface->bufferScale();
+    const QSizeF transformedSize = (rotation % 180 == 0 ? bufferSize
+                                                        : bufferSize.transposed());
+    QRectF source = surface->sourceGeometry();
+    if (!source.isValid() ||
+            (rotation % 180 != 0 && source == QRectF(QPointF(), bufferSize))) {
+        source = QRectF(QPointF(), transformedSize);
+    }
+    QTransform transform = QTransform::fromScale(source.width() / destSize.width(),
+                                                 source.height() / destSize.height());
+    transform *= QTransform::fromTranslate(source.x(), source.y());
+    // The buffer holds the surface rotated clockwise by the rotation.
+    const qreal w = transformedSize.width();
+    const qreal h = transformedSize.height();
+    switch (rotation) {
+    case 90:
+        transform *= QTransform(0, 1, -1, 0, h, 0);
+        break;
+    case 180:
+        transform *= QTransform(-1, 0, 0, -1, w, h);
+        break;
+    case 270:
+        transform *= QTransform(0, -1, 1, 0, 0, w);
+        break;
+    }
+    transform *= QTransform::fromScale(surface->bufferScale(),
+                                       surface->bufferScale());
+    return transform;
+}
+
+QTransform View::textureTransform() const
 {
-    const QSize size = output()->geometry().size();
+    QWaylandSurface *surface = this->surface();
+    if (!surface || surfaceSize().isEmpty() ||
+            surface->bufferSize().isEmpty()) {
+        return QTransform();
+    }
+    const QSize bufferSize = surface->bufferSize();
+    QTransform transform = surfaceToBuffer();
+    transform *= QTransform::fromScale(1.0 / bufferSize.width(),
+                                       1.0 / bufferSize.height());
+    if (m_origin == QOpenGLTextureBlitter::OriginBottomLeft) {
+        transform *= QTransform(1, 0, 0, -1, 0, 1);
+    }
+    if (!m_atlasRect.isNull() && m_texture == TextureAtlas::instance()->texture()) {
+        const QRectF atlasRect = TextureAtlas::instance()->sourceRect(m_atlasRect);
+        transform *= QTransform(atlasRect.width(), 0, 0, atlasRect.height(),
+                                atlasRect.x(), atlasRect.y());
+    }
+    return transform;
+}
+
+QSize View::outputSize() const
+{
+    auto *window = (output() ? qobject_cast<Window *>(output()->window())
+                             : nullptr);
+    return (window ? window->outputSize() : surfaceSize());
+}
+
+void View::onOutputSizeChanged()
+{
+    const QSize size = outputSize();
     if (m_wlShellSurface) {
         m_wlShellSurface->sendConfigure(size, QWaylandWlShellSurface::NoneEdge);
     } else if (m_xdgToplevel) {
@@ -140,10 +395,126 @@ void View::onOutputGeometryChanged()
     }
 }
 
+void View::setSuspended(bool suspended)
+{
+    if (m_xdgToplevel) {
+        // The suspended state of xdg_toplevel needs a newer xdg_wm_base than
+        // QtWaylandCompositor implements, so hidden toplevels are only told
+        // that they are not active.
+        QVector<QWaylandXdgToplevel::State> states = m_xdgToplevel->states();
+        states.removeAll(QWaylandXdgToplevel::ActivatedState);
+        if (!suspended && surface() &&
+                m_compositor->defaultSeat()->keyboardFocus() == surface()) {
+            states.append(QWaylandXdgToplevel::ActivatedState);
+        }
+        m_xdgToplevel->sendConfigure(outputSize(), states);
+#ifdef XWAYLAND
+    } else if (m_xwmWindow) {
+        m_xwmWindow->setHidden(suspended);
+#endif
+    }
+}
+
+void View::onSurfaceDamaged(const QRegion &region)
+{
+    if (!surface()) {
+        return;
+    }
+    m_damage += region & QRect(QPoint(), surfaceSize());
+    // Keep the region cheap to map; a few large rects repaint faster than
+    // many tiny ones anyway.
+    if (m_damage.rectCount() > 8) {
+        m_damage = m_damage.boundingRect();
+    }
+
+    const QTransform transform = (surfaceSize().isEmpty() ?
+                                  QTransform() : surfaceToBuffer());
+    for (const QRect &rect : region) {
+        m_shmDamage += transform.mapRect(QRectF(rect)).toAlignedRect();
+    }
+    if (m_shmDamage.rectCount() > 8) {
+        m_shmDamage = m_shmDamage.boundingRect();
+    }
+}
+
+void View::onSurfaceRedraw()
+{
+    emit inputBoundsChanged();
+    m_commits++;
+    if (m_lastCommit.isValid()) {
+        m_commitIntervals.add(m_lastCommit.nsecsElapsed());
+    }
+    m_lastCommit.start();
+}
+
+QVariantMap View::statistics() const
+{
+    QVariantMap map;
+    map.insert(QStringLiteral("appId"), appId());
+    map.insert(QStringLiteral("title"), title());
+    map.insert(QStringLiteral("commits"), m_commits);
+    map.insert(QStringLiteral("commitInterval"),
+               m_commitIntervals.toVariantList());
+    return map;
+}
+
+QRegion View::takeDamage()
+{
+    QRegion damage = m_damage;
+    m_damage = QRegion();
+    return damage;
+}
+
 void View::onOffsetForNextFrame(const QPoint &offset)
 {
     m_offset = offset;
-    m_position += offset;
+    setPosition(m_position + offset);
+}
+
+void View::setPosition(const QPointF &position)
+{
+    m_position = position;
+    emit inputBoundsChanged();
+}
+
+QRectF View::inputBounds() const
+{
+    QWaylandSurface *surface = this->surface();
+    if (!surface) {
+        return QRectF();
+    }
+    // The input region is infinite unless set, and clipped to the surface.
+    const QRect rect(QPoint(), surfaceSize());
+    const QRect bounds = (QWaylandSurfacePrivate::get(surface)->inputRegion &
+                          rect).boundingRect();
+    return QRectF(bounds).translated(m_position);
+}
+
+bool View::acceptsInput(const QPointF &point) const
+{
+    QWaylandSurface *surface = this->surface();
+    return (surface && surface->inputRegionContains(point - m_position));
+}
+
+bool View::isResizePending() const
+{
+#ifdef XWAYLAND
+    if (m_xwmWindow) {
+        return m_xwmWindow->isResizePending();
+    }
+#endif
+    return false;
+}
+
+void View::sendFrameDrawn(quint64 timestamp)
+{
+#ifdef XWAYLAND
+    if (m_xwmWindow) {
+        m_xwmWindow->sendFrameDrawn(timestamp);
+    }
+#else
+    Q_UNUSED(timestamp);
+#endif
 }
 
 void View::sendClose()
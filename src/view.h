@@ -51,16 +51,26 @@
 #ifndef VIEW_H
 #define VIEW_H
 
+#include <QElapsedTimer>
+#include <QImage>
 #include <QOpenGLTextureBlitter>
 #include <QPointF>
 #include <QPoint>
+#include <QRect>
+#include <QRectF>
+#include <QRegion>
 #include <QSize>
 #include <QString>
+#include <QTransform>
+#include <QVariantMap>
 #include <QWaylandView>
 
+#include "framestatistics.h"
+
 QT_BEGIN_NAMESPACE
 
 class QOpenGLTexture;
+class QWaylandBufferRef;
 class QWaylandOutput;
 class QWaylandSurface;
 class QWaylandWlShellSurface;
@@ -79,23 +89,85 @@ public:
     View(Compositor *compositor, QWaylandSurface *surface);
     ~View();
     QOpenGLTexture *getTexture();
+    // Frees the texture the compositor uploaded the buffer to, which
+    // getTexture() uploads again.
+    void releaseTexture();
     QOpenGLTextureBlitter::Origin textureOrigin() const;
+    // Maps surface coordinates to texture coordinates, with the crop and
+    // scale of the surface viewport.
+    QTransform textureTransform() const;
+    // The size of the surface, with the buffer transform applied.
+    QSize surfaceSize() const;
+    // How far the client drew its buffer rotated clockwise, in degrees.
+    int bufferRotation() const;
     QPointF position() const { return m_position; }
+    void setPosition(const QPointF &position);
+    // The bounds of the input region of the surface in window coordinates,
+    // before the window transform.
+    QRectF inputBounds() const;
+    // Whether a point in window coordinates, before the window transform,
+    // is in the input region of the surface.
+    bool acceptsInput(const QPointF &point) const;
     QPoint offset() const { return m_offset; }
     QString appId() const;
     QString title() const;
 
+    QRegion takeDamage();
+    QRegion opaqueRegion() const;
+
+    // Tells the client whether its window can be seen.
+    void setSuspended(bool suspended);
+    // Whether the window is to keep showing its last frame until the
+    // client has drawn at its new size.
+    bool isResizePending() const;
+    // Tells the client that its frame was drawn, for clients that pace
+    // themselves to that.
+    void sendFrameDrawn(quint64 timestamp);
+
+    QVariantMap statistics() const;
+
 private:
     friend class Compositor;
+    friend class Window;
+
+    void updateBufferState(const QWaylandBufferRef &buf);
+    QTransform surfaceToBuffer() const;
+    // The logical size to configure toplevels to.
+    QSize outputSize() const;
+    QOpenGLTexture *uploadShmBuffer(const QWaylandBufferRef &buf);
+    void uploadShmRect(const QImage &image, const QRect &rect,
+                       const QPoint &offset);
+
     Compositor *m_compositor;
     GLenum m_textureTarget = GL_TEXTURE_2D;
     QOpenGLTexture *m_texture = nullptr;
     QOpenGLTexture *m_shmTexture = nullptr;
     QOpenGLTextureBlitter::Origin m_origin;
+    bool m_bufferHasAlpha = true;
+    // The current buffer was advanced to without updating the texture.
+    bool m_textureStale = false;
     QPointF m_position;
     View *m_parentView = nullptr;
     QPoint m_offset;
     bool m_hide = false;
+    // Behind another toplevel of a shared window, so not shown.
+    bool m_background = false;
+    // Surface-local damage not yet repainted, and the window-space rect
+    // the view covered in the last frame.
+    QRegion m_damage;
+    QRect m_paintedRect;
+    // Buffer damage not yet uploaded to m_shmTexture or the atlas.
+    QRegion m_shmDamage;
+    // Where small shared memory buffers are kept in the texture atlas
+    // instead of m_shmTexture, and for how many frames in a row the buffer
+    // has changed.
+    QRect m_atlasRect;
+    int m_contentUpdates = 0;
+    // Uploaded since last taken for the statistics of the window.
+    qint64 m_uploadedBytes = 0;
+    quint64 m_commits = 0;
+    Histogram m_commitIntervals;
+    QElapsedTimer m_lastCommit;
 
     QWaylandWlShellSurface *m_wlShellSurface = nullptr;
     QWaylandXdgToplevel *m_xdgToplevel = nullptr;
@@ -104,12 +176,18 @@ private:
     XwmWindow *m_xwmWindow = nullptr;
 #endif
 
+signals:
+    // Moved, or its surface committed.
+    void inputBoundsChanged();
+
 public slots:
     void onOffsetForNextFrame(const QPoint &offset);
     void sendClose();
 
 private slots:
-    void onOutputGeometryChanged();
+    void onOutputSizeChanged();
+    void onSurfaceDamaged(const QRegion &region);
+    void onSurfaceRedraw();
 };
 
 QT_END_NAMESPACE
@@ -50,50 +50,131 @@
 
 #include "window.h"
 
-#include <QMatrix4x4>
+#include <QDebug>
+#include <QExposeEvent>
 #include <QMouseEvent>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
 #include <QOpenGLFunctions>
 #include <QOpenGLTexture>
 #include <QOpenGLTextureBlitter>
-#include <QOpenGLWindow>
-#include <QPainter>
 #include <QPoint>
 #include <QPointF>
 #include <QRect>
 #include <QRectF>
 #include <QScreen>
-#include <QSet>
 #include <QTimer>
 #include <QTouchEvent>
 #include <QTransform>
 #include <QWaylandOutput>
+#include <QWaylandBufferRef>
+#include <QWaylandClient>
 #include <QWaylandOutputMode>
+#include <QWaylandPointer>
 #include <QWaylandSeat>
 #include <QWaylandView>
+#include <QWheelEvent>
+#include <QtMath>
+#include <QtWaylandCompositor/private/qwaylandpointer_p.h>
+#include <algorithm>
 
 #include "compositor.h"
+#include "fractionalscale.h"
+#include "passthrough.h"
+#include "presentationtime.h"
+#include "renderthread.h"
+#include "repaintscheduler.h"
+#include "texturemanager.h"
+#include "trace.h"
 #include "view.h"
 
-QVector<Window *> Window::m_windowsToDelete;
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+
+// Interval of frame callbacks to clients of windows that are not exposed.
+static const int suspendedFrameInterval = 1000;
+// How long views stay hidden before their textures are freed, in ms.
+static const int hiddenTextureTimeout = 10000;
+
+// The transform of an output shown rotated clockwise by the rotation.
+static QWaylandOutput::Transform outputTransform(int rotation)
+{
+    switch (rotation) {
+    case 90:
+        return QWaylandOutput::Transform90;
+    case 180:
+        return QWaylandOutput::Transform180;
+    case 270:
+        return QWaylandOutput::Transform270;
+    default:
+        return QWaylandOutput::TransformNormal;
+    }
+}
+
+static bool hasFenceSync(QOpenGLContext *context)
+{
+    const QPair<int, int> version = context->format().version();
+    return (context->isOpenGLES() ? version >= qMakePair(3, 0)
+                                  : version >= qMakePair(3, 2));
+}
+
+// The pixels entirely within a rect, for scaled opaque regions.
+static QRect innerRect(const QRectF &rect)
+{
+    return QRect(QPoint(qCeil(rect.left()), qCeil(rect.top())),
+                 QPoint(qFloor(rect.right()) - 1, qFloor(rect.bottom()) - 1));
+}
 
 Window::Window(Compositor *compositor)
     : m_compositor(compositor)
+    , m_repaintScheduler(new RepaintScheduler(this))
 {
+    setSurfaceType(QWindow::OpenGLSurface);
     resize(0, 0);
+    if (RenderThread::isEnabled()) {
+        m_renderThread = new RenderThread(this);
+        connect(m_renderThread, &RenderThread::frameSwapped,
+                this, &Window::onFrameSwapped);
+    }
     connect(m_compositor, &Compositor::keyboardRect,
             this, &Window::onKeyboardRect);
     connect(this, &QWindow::visibleChanged,
             this, &Window::updateOutputMode);
+    connect(this, &QWindow::screenChanged,
+            this, &Window::onScreenChanged);
+    connect(m_repaintScheduler, &RepaintScheduler::repaint,
+            this, &QWindow::requestUpdate);
+    m_suspendedFrameTimer.setInterval(suspendedFrameInterval);
+    m_inputFlushTimer.setSingleShot(true);
+    m_inputFlushTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_inputFlushTimer, &QTimer::timeout,
+            this, &Window::flushInput);
+    connect(&m_suspendedFrameTimer, &QTimer::timeout,
+            this, &Window::sendSuspendedFrameCallbacks);
+    m_hiddenTextureTimer.setSingleShot(true);
+    m_hiddenTextureTimer.setInterval(hiddenTextureTimeout);
+    connect(&m_hiddenTextureTimer, &QTimer::timeout,
+            this, &Window::releaseHiddenTextures);
     onScreenChanged(screen());
 }
 
-void Window::deletePendingWindows()
+Window::~Window()
 {
-    const QVector<Window *> windowsToDelete = m_windowsToDelete;
-    for (Window *window : windowsToDelete) {
-        window->deleteLater();
+    // The render thread must be done with the window surface before it is
+    // destroyed.
+    delete m_renderThread;
+    if (!m_context) {
+        return;
+    }
+    if (m_context->makeCurrent(this)) {
+        m_renderer.cleanup();
     }
-    m_windowsToDelete.clear();
+    // QtWaylandCompositor frees the textures of client buffers made in the
+    // context as it is destroyed, which takes a context sharing them.
+    TextureManager::instance()->ensureContext();
+    delete m_context;
+    m_context = nullptr;
 }
 
 void Window::onScreenChanged(QScreen *screen)
@@ -101,6 +182,8 @@ void Window::onScreenChanged(QScreen *screen)
     if (m_previousScreen) {
         disconnect(m_previousScreen.data(), &QScreen::orientationChanged,
                    this, &Window::onScreenOrientationChanged);
+        disconnect(m_previousScreen.data(), &QScreen::physicalDotsPerInchChanged,
+                   this, &Window::updateOutputMode);
         m_previousScreen = nullptr;
     }
     if (screen) {
@@ -110,99 +193,528 @@ void Window::onScreenChanged(QScreen *screen)
                                          Qt::InvertedLandscapeOrientation);
         connect(screen, &QScreen::orientationChanged,
                 this, &Window::onScreenOrientationChanged);
+        connect(screen, &QScreen::physicalDotsPerInchChanged,
+                this, &Window::updateOutputMode);
     }
+    updateOutputMode();
 }
 
 void Window::addView(View *view)
 {
     connect(view, &QWaylandView::surfaceDestroyed,
             this, &Window::viewSurfaceDestroyed);
+    connect(view, &View::inputBoundsChanged,
+            this, &Window::onViewInputBoundsChanged);
     m_views << view;
+    invalidateInputIndex();
+    if (view->surface()) {
+        m_compositor->fractionalScale()->setPreferredScale(view->surface(),
+                                                           m_scale);
+    }
+    if (!m_currentToplevel) {
+        m_currentToplevel = view;
+    } else if (toplevelOf(view) == view) {
+        // Another toplevel of a shared window.
+        raiseToplevel(view);
+    } else {
+        view->m_background = (toplevelOf(view) != m_currentToplevel);
+    }
+    if (m_suspended || view->m_background) {
+        view->setSuspended(true);
+    }
 }
 
-void Window::viewSurfaceDestroyed()
+View *Window::toplevelOf(View *view) const
 {
-    auto *view = qobject_cast<View *>(sender());
-    m_views.removeAll(view);
-    if (m_views.empty()) {
-        // Keep window alive until next call to
-        // WaylandEglClientBufferIntegrationPrivate::deleteOrphanedTextures()
-        // (by QWaylandBufferRef::toOpenGLTexture() by View::getTexture())
-        hide();
-        m_windowsToDelete.append(this);
+    // Popups of views in other windows are toplevels in theirs.
+    while (view->m_parentView &&
+           view->m_parentView->output() == view->output()) {
+        view = view->m_parentView;
+    }
+    return view;
+}
+
+void Window::raiseToplevel(View *view)
+{
+    View *toplevel = toplevelOf(view);
+    if (toplevel == m_currentToplevel) {
+        return;
+    }
+    m_currentToplevel = toplevel;
+    for (View *other : qAsConst(m_views)) {
+        const bool background = (toplevelOf(other) != toplevel);
+        if (background != other->m_background) {
+            other->m_background = background;
+            other->setSuspended(background || m_suspended);
+        }
+    }
+    // The others stay in the order they were last shown in.
+    std::stable_partition(m_views.begin(), m_views.end(),
+                          [](View *view) { return view->m_background; });
+    invalidateInputIndex();
+    if (isActive() && toplevel->surface()) {
+        m_compositor->setFocusSurface(toplevel->surface());
+    }
+    // Views that were hidden or shown are damaged when collected.
+    scheduleRepaint();
+    m_hiddenTextureTimer.start();
+}
+
+void Window::showPreviousToplevel()
+{
+    for (auto i = m_views.crbegin(), end = m_views.crend(); i != end; ++i) {
+        View *view = *i;
+        if (view != m_currentToplevel && toplevelOf(view) == view &&
+                view->surface() && m_compositor->surfaceIsMapped(view->surface())) {
+            raiseToplevel(view);
+            return;
+        }
     }
 }
 
-void Window::initializeGL()
+void Window::setSuspended(bool suspended)
 {
-    m_textureBlitter.create();
+    if (suspended == m_suspended) {
+        return;
+    }
+    m_suspended = suspended;
+    if (suspended) {
+        m_suspendedFrameTimer.start();
+        m_hiddenTextureTimer.start();
+    } else {
+        m_suspendedFrameTimer.stop();
+        damageAll();
+    }
+    for (View *view : qAsConst(m_views)) {
+        view->setSuspended(suspended || view->m_background);
+    }
 }
 
-void Window::resizeGL(int w, int h)
+void Window::releaseHiddenTextures()
 {
-    QImage backgroundImage(w, h, QImage::Format_RGB32);
-    backgroundImage.fill(Qt::white);
-    QPainter p(&backgroundImage);
-    p.fillRect(0, 0, w, h, Qt::Dense4Pattern);
-    p.end();
-    m_backgroundTexture = new QOpenGLTexture(backgroundImage,
-                                             QOpenGLTexture::DontGenerateMipMaps);
+    // The render thread may still be drawing with them.
+    if (m_frameInFlight) {
+        m_hiddenTextureTimer.start();
+        return;
+    }
+    for (View *view : qAsConst(m_views)) {
+        if (m_suspended || view->m_background || !view->surface() ||
+                !m_compositor->surfaceHasContent(view->surface())) {
+            view->releaseTexture();
+        }
+    }
 }
 
-void Window::paintGL()
+void Window::sendSuspendedFrameCallbacks()
 {
     QWaylandOutput *output = m_compositor->outputFor(this);
     if (output) {
         output->frameStarted();
+        output->sendFrameCallbacks();
     }
+    sendFrameDrawn(PresentationTime::now());
+}
 
-    QOpenGLFunctions *functions = context()->functions();
-    functions->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void Window::sendFrameDrawn(quint64 timestamp)
+{
+    for (View *view : qAsConst(m_views)) {
+        view->sendFrameDrawn(timestamp);
+    }
+}
 
-    m_textureBlitter.bind();
+bool Window::isResizePending() const
+{
+    for (View *view : m_views) {
+        if (view->isResizePending()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Window::damageAll()
+{
+    m_damage = QRect(QPoint(), size());
+    requestUpdate();
+}
 
-    functions->glEnable(GL_BLEND);
-    functions->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+void Window::scheduleRepaint()
+{
+    m_repaintScheduler->schedule();
+}
+
+void Window::viewSurfaceDestroyed()
+{
+    auto *view = qobject_cast<View *>(sender());
+    m_damage += view->m_paintedRect;
+    m_views.removeAll(view);
+    invalidateInputIndex();
+    // Transients left behind become toplevels of their own.
+    for (View *child : qAsConst(m_views)) {
+        if (child->m_parentView == view) {
+            child->m_parentView = nullptr;
+        }
+    }
+    if (view == m_currentToplevel) {
+        m_currentToplevel = nullptr;
+        showPreviousToplevel();
+    }
+    if (m_views.empty()) {
+        hide();
+        deleteLater();
+    }
+}
+
+void Window::collectDamage(const QRect &viewportRect)
+{
+    for (View *view : qAsConst(m_views)) {
+        QWaylandSurface *surface = view->surface();
+        const QRegion surfaceDamage = view->takeDamage();
+        QRect rect;
+        if (surface && m_compositor->surfaceHasContent(surface) &&
+                !view->surfaceSize().isEmpty()) {
+            rect = m_transform.mapRect(QRectF(view->position(),
+                                              view->surfaceSize())).toAlignedRect();
+        }
+        if (rect != view->m_paintedRect) {
+            // Moved, resized, shown or hidden.
+            m_damage += view->m_paintedRect;
+            m_damage += rect;
+            view->m_paintedRect = rect;
+        } else if (!rect.isEmpty()) {
+            for (const QRect &r : surfaceDamage) {
+                QRectF damageRect = QRectF(r).translated(view->position());
+                m_damage += m_transform.mapRect(damageRect).toAlignedRect();
+            }
+        }
+    }
+    m_damage &= viewportRect;
+}
+
+bool Window::makeCurrent()
+{
+    if (m_renderThread) {
+        return TextureManager::instance()->makeCurrent();
+    }
+    if (!m_context) {
+        m_context = new QOpenGLContext(this);
+        m_context->setShareContext(QOpenGLContext::globalShareContext());
+        m_context->setFormat(requestedFormat());
+        if (!m_context->create() || !m_context->makeCurrent(this)) {
+            qWarning() << "could not create window context";
+            delete m_context;
+            m_context = nullptr;
+            return false;
+        }
+        m_renderer.initialize();
+        return true;
+    }
+    return m_context->makeCurrent(this);
+}
+
+RenderFrame Window::prepareFrame()
+{
+    TraceSpan span("prepareFrame");
+    RenderFrame frame;
+    frame.size = size();
 
     QRect viewportRect(QPoint(), size());
 
-    m_textureBlitter.blit(m_backgroundTexture->textureId(),
-                          QOpenGLTextureBlitter::targetTransform(viewportRect,
-                                                                 viewportRect),
-                          QOpenGLTextureBlitter::OriginTopLeft);
+    collectDamage(viewportRect);
+    frame.damage = m_damage;
+    m_damage = QRegion();
+    frame.measureGpuTime = FrameStatistics::isGpuTimingRequested();
 
-    GLenum currentTarget = GL_TEXTURE_2D;
+    qint64 uploadedBytes = 0;
+    QVector<QRegion> opaqueRegions;
+    frame.items.reserve(m_views.size());
+    opaqueRegions.reserve(m_views.size());
+
+    // Every view must get its texture, even outside of the damage, so that
+    // its buffer advances.
     for (View *view : qAsConst(m_views)) {
         QOpenGLTexture *texture = view->getTexture();
+        uploadedBytes += view->m_uploadedBytes;
+        view->m_uploadedBytes = 0;
         if (!texture) {
             continue;
         }
-        if (texture->target() != currentTarget) {
-            currentTarget = texture->target();
-            m_textureBlitter.bind(currentTarget);
-        }
         QWaylandSurface *surface = view->surface();
         if (surface && m_compositor->surfaceHasContent(surface)) {
-            QSize destSize = surface->destinationSize();
+            QSize destSize = view->surfaceSize();
             if (destSize.isEmpty()) {
                 continue;
             }
             QRectF targetRect = m_transform.mapRect(QRectF(view->position(),
                                                            destSize));
-            QMatrix4x4 m = QOpenGLTextureBlitter::targetTransform(targetRect,
-                                                                  viewportRect);
-            m.rotate(-m_rotation, 0, 0, 1);
-            m_textureBlitter.blit(texture->textureId(), m,
-                                  view->textureOrigin());
+            const QRect rect = targetRect.toAlignedRect();
+
+            // From window coordinates to the surface, and from there to the
+            // buffer, as cropped and scaled by its viewport, in the texture.
+            const QTransform surfaceTransform =
+                    QTransform::fromTranslate(view->position().x(),
+                                              view->position().y()) * m_transform;
+            const QTransform textureTransform = (surfaceTransform.inverted() *
+                                                 view->textureTransform());
+            QRegion opaqueRegion;
+            for (const QRect &r : view->opaqueRegion()) {
+                QRectF opaqueRect = QRectF(r).translated(view->position());
+                opaqueRegion += innerRect(m_transform.mapRect(opaqueRect));
+            }
+            m_presentationFeedback += m_compositor->presentation()->takeFeedback(surface);
+            if (m_renderThread) {
+                m_inFlightBuffers << view->currentBuffer();
+            }
+            frame.items.append({texture->textureId(), texture->target(),
+                                textureTransform, rect, QRegion(),
+                                (QRegion(rect) - opaqueRegion).isEmpty()});
+            opaqueRegions.append(opaqueRegion);
         }
     }
-    functions->glDisable(GL_BLEND);
 
-    m_textureBlitter.release();
+    m_statistics.recordUpload(uploadedBytes);
+    Trace::counter("uploadedBytes", uploadedBytes);
+
+    // Find what is left of each view after the opaque parts of the views
+    // above it, so that hidden views, and the background, are not drawn.
+    for (int i = frame.items.size() - 1; i >= 0; i--) {
+        RenderItem &item = frame.items[i];
+        item.visibleRegion = QRegion(item.rect) - frame.covered;
+        frame.covered += opaqueRegions.at(i);
+    }
+
+    return frame;
+}
 
+void Window::render()
+{
+    if (!isExposed() || size().isEmpty()) {
+        return;
+    }
+    if (m_frameInFlight) {
+        // Drawn when the render thread is done with the current frame.
+        m_renderPending = true;
+        return;
+    }
+    TraceSpan span("paint");
+    m_paintTimer.start();
+    if (!makeCurrent()) {
+        return;
+    }
+
+    QWaylandOutput *output = m_compositor->outputFor(this);
+    if (output) {
+        output->frameStarted();
+    }
+
+    RenderFrame frame = prepareFrame();
+
+    if (m_renderThread) {
+        // The uploads must be done before the render thread uses the
+        // textures, which flushing alone does not promise across contexts.
+        // The fence itself must be flushed for the render thread to see it.
+        QOpenGLContext *context = QOpenGLContext::currentContext();
+        if (hasFenceSync(context)) {
+            frame.uploadFence = context->extraFunctions()->glFenceSync(
+                        GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        if (frame.uploadFence) {
+            context->functions()->glFlush();
+        } else {
+            context->functions()->glFinish();
+        }
+        m_prepareTime = m_paintTimer.nsecsElapsed();
+        m_frameInFlight = true;
+        m_renderThread->render(frame);
+        return;
+    }
+
+    m_renderer.render(frame);
+    const qint64 paintTime = m_paintTimer.nsecsElapsed();
+    m_repaintScheduler->addPaintTime(paintTime);
+    {
+        // Includes waiting for the host to be done with the previous frame.
+        TraceSpan swapSpan("swapBuffers");
+        m_context->swapBuffers(this);
+    }
+    recordFrame(paintTime, m_renderer.takeGpuTime());
+    onFramePresented();
+}
+
+void Window::recordFrame(qint64 paintTime, qint64 gpuTime)
+{
+    // Frames that took longer than a refresh from the start of their
+    // composition to being handed to the host missed a refresh.
+    const qint64 latency = m_paintTimer.nsecsElapsed();
+    const int missedFrames = int(latency / m_repaintScheduler->refreshPeriod());
+    m_statistics.recordFrame(paintTime, gpuTime, missedFrames);
+}
+
+void Window::onFrameSwapped(qint64 renderTime, qint64 gpuTime)
+{
+    m_frameInFlight = false;
+    m_inFlightBuffers.clear();
+    m_repaintScheduler->addPaintTime(m_prepareTime + renderTime);
+    recordFrame(m_prepareTime + renderTime, gpuTime);
+    onFramePresented();
+    if (m_renderPending) {
+        m_renderPending = false;
+        requestUpdate();
+    }
+}
+
+View *Window::passthroughView() const
+{
+    if (devicePixelRatio() != 1 || !Passthrough::isSupported()) {
+        return nullptr;
+    }
+    View *passthroughView = nullptr;
+    for (View *view : m_views) {
+        QWaylandSurface *surface = view->surface();
+        if (!surface || !m_compositor->surfaceHasContent(surface)) {
+            continue;
+        }
+        if (passthroughView) {
+            // Popups and subsurfaces must be composited.
+            return nullptr;
+        }
+        passthroughView = view;
+    }
+    if (!passthroughView || passthroughView->position() != QPointF()) {
+        return nullptr;
+    }
+    // The buffer must cover the window pixel for pixel, which on a rotated
+    // window needs a client that draws its buffers rotated to match.
+    QWaylandSurface *surface = passthroughView->surface();
+    const QRectF bufferRect(QPointF(), QSizeF(surface->bufferSize()) /
+                                       surface->bufferScale());
+    if (surface->bufferSize() != size() ||
+            passthroughView->bufferRotation() != m_rotation ||
+            surface->sourceGeometry() != bufferRect ||
+            m_transform.mapRect(QRectF(QPointF(), passthroughView->surfaceSize())) !=
+            QRectF(QPointF(), size())) {
+        return nullptr;
+    }
+    return passthroughView;
+}
+
+bool Window::updatePassthrough()
+{
+    // When a single opaque view fills the window, its buffers are shown
+    // directly on a subsurface of the host window instead of being
+    // composited.
+    View *view = passthroughView();
+    wl_surface *hostSurface = view ? Passthrough::hostSurface(this) : nullptr;
+    if (m_passthrough && (!view || m_passthrough->parentSurface() != hostSurface)) {
+        stopPassthrough();
+    }
+    if (!view || !hostSurface) {
+        return false;
+    }
+    if (!m_passthrough) {
+        m_passthrough = new Passthrough(this);
+        connect(m_passthrough, &Passthrough::frameDone,
+                this, &Window::onFramePresented);
+        connect(m_passthrough, &Passthrough::frameDone,
+                this, &QWindow::requestUpdate);
+    }
+    if (m_passthrough->isFramePending()) {
+        // Updated again when the host is done with the current frame.
+        return true;
+    }
+
+    const bool newContent = view->advance();
+    QWaylandBufferRef buf = view->currentBuffer();
+    if (newContent) {
+        view->updateBufferState(buf);
+        view->m_textureStale = true;
+    }
+    const QImage image = buf.isSharedMemory() ? buf.image() : QImage();
+    const QRect viewRect(QPoint(), size());
+    if (image.size() != size() || !Passthrough::isSupportedFormat(image) ||
+            view->textureOrigin() != QOpenGLTextureBlitter::OriginTopLeft ||
+            !(QRegion(QRect(QPoint(), view->surfaceSize())) -
+              view->opaqueRegion()).isEmpty()) {
+        stopPassthrough();
+        return false;
+    }
+
+    QWaylandOutput *output = m_compositor->outputFor(this);
+    if (output) {
+        output->frameStarted();
+    }
+    view->takeDamage();
+    if (newContent || !m_passthrough->isActive()) {
+        TraceSpan span("passthrough", view->surface());
+        m_paintTimer.start();
+        const QRegion damage = (m_passthrough->isActive() ?
+                                view->m_shmDamage : QRegion(viewRect));
+        view->m_shmDamage = QRegion();
+        if (!m_passthrough->present(image, damage)) {
+            stopPassthrough();
+            return false;
+        }
+        for (const QRect &rect : damage) {
+            m_statistics.recordUpload(qint64(rect.width()) * rect.height() * 4);
+        }
+        m_statistics.recordFrame(m_paintTimer.nsecsElapsed(), -1, 0);
+        m_presentationFeedback += m_compositor->presentation()->takeFeedback(view->surface());
+    }
     if (output) {
         output->sendFrameCallbacks();
     }
+    return true;
+}
+
+void Window::stopPassthrough()
+{
+    if (m_passthrough->isActive()) {
+        m_passthrough->stop();
+        // The passed through buffers were never uploaded, and the window
+        // contents are stale.
+        for (View *view : qAsConst(m_views)) {
+            if (view->surface()) {
+                view->m_shmDamage = QRect(QPoint(),
+                                          view->surface()->bufferSize());
+            }
+        }
+        m_damage = QRect(QPoint(), size());
+    }
+    if (m_passthrough->parentSurface() != Passthrough::hostSurface(this)) {
+        delete m_passthrough;
+        m_passthrough = nullptr;
+    }
+}
+
+void Window::onFramePresented()
+{
+    // There is no presentation feedback from the host, so the time the
+    // frame was handed to it is used.
+    TraceSpan span("framePresented");
+    const quint64 timestamp = PresentationTime::now();
+    m_frameSequence++;
+    m_repaintScheduler->framePresented(timestamp);
+
+    // Clients are let to draw as soon as the previous frame is out, while
+    // the next one is composited as late as possible.
+    QWaylandOutput *output = m_compositor->outputFor(this);
+    if (output) {
+        output->sendFrameCallbacks();
+    }
+    sendFrameDrawn(timestamp);
+
+    if (m_presentationFeedback.isEmpty()) {
+        return;
+    }
+    const quint32 refresh = m_repaintScheduler->refreshPeriod();
+    const PresentationFeedbackList feedbackList = m_presentationFeedback;
+    m_presentationFeedback.clear();
+    for (PresentationFeedback *feedback : feedbackList) {
+        if (feedback) {
+            feedback->sendPresented(output, timestamp, refresh,
+                                    m_frameSequence, 0);
+        }
+    }
 }
 
 void Window::onScreenOrientationChanged(Qt::ScreenOrientation orientation)
@@ -211,6 +723,22 @@ void Window::onScreenOrientationChanged(Qt::ScreenOrientation orientation)
     updateOutputMode();
 }
 
+qreal Window::scaleForScreen(QScreen *screen)
+{
+    bool ok;
+    const qreal scale = qEnvironmentVariable("NEWCOMPOSITOR_SCALE").toDouble(&ok);
+    if (ok && scale > 0) {
+        return scale;
+    }
+    const qreal dpi = (screen ? screen->physicalDotsPerInch() : 0);
+    if (!qIsFinite(dpi) || dpi <= 0) {
+        return 1;
+    }
+    // 1 at 160 dpi, in steps of a quarter so that common sizes stay whole
+    // numbers of pixels.
+    return qMax<qreal>(1, qRound(dpi / 160 * 4) / 4.0);
+}
+
 void Window::updateOutputMode()
 {
     QSize outputSize = size();
@@ -246,13 +774,33 @@ void Window::updateOutputMode()
 
     emit rotationChanged(m_rotation);
 
+    const qreal scale = scaleForScreen(screen());
+    const bool scaleChanged = (scale != m_scale);
+    m_scale = scale;
+    // Each axis is scaled a little differently, if need be, for the logical
+    // size of the output to cover the window exactly.
+    const QSize logicalSize = (QSizeF(outputSize) / m_scale).toSize()
+            .expandedTo(QSize(1, 1));
+    const qreal xScale = qreal(outputSize.width()) / logicalSize.width();
+    const qreal yScale = qreal(outputSize.height()) / logicalSize.height();
+    m_transform.scale(xScale, yScale);
+
     bool invertible;
     m_inverseTransform = m_transform.inverted(&invertible);
     Q_ASSERT(invertible);
 
     outputSize.setHeight(outputSize.height() - m_keyboardHeight);
 
-    QWaylandOutputMode mode(outputSize, refreshRate);
+    // Modes are in pixels, and clients that only know whole scales draw at
+    // the next one up.
+    output->setScaleFactor(qCeil(m_scale));
+    // The mode is in the orientation of the window, and the transform lets
+    // clients draw their buffers rotated to match it, so that they can be
+    // shown without rotating them.
+    output->setTransform(outputTransform(m_rotation));
+    QWaylandOutputMode mode(m_rotation % 180 == 0 ? outputSize
+                                                  : outputSize.transposed(),
+                            refreshRate);
     bool modeAdded = false;
     for (QWaylandOutputMode addedMode : output->modes()) {
         if (addedMode == mode) {
@@ -265,7 +813,23 @@ void Window::updateOutputMode()
     }
     output->setCurrentMode(mode);
 
-    requestUpdate();
+    if (scaleChanged) {
+        for (View *view : qAsConst(m_views)) {
+            if (view->surface()) {
+                m_compositor->fractionalScale()->setPreferredScale(view->surface(),
+                                                                   m_scale);
+            }
+        }
+    }
+
+    const QSize outputLogicalSize(logicalSize.width(),
+                                  qMax(1, qRound(outputSize.height() / yScale)));
+    if (outputLogicalSize != m_outputSize) {
+        m_outputSize = outputLogicalSize;
+        emit outputSizeChanged();
+    }
+
+    damageAll();
 }
 
 void Window::onKeyboardRect(bool active, int x, int y, int width, int height)
@@ -306,8 +870,24 @@ bool Window::event(QEvent *e)
     case QEvent::Close:
         closeEvent(reinterpret_cast<QCloseEvent *>(e));
         break;
+    case QEvent::UpdateRequest:
+        // Clients get the latest input in time to draw for this frame.
+        flushInput();
+        if (!isExposed()) {
+            break;
+        }
+        if (isResizePending()) {
+            // The last frame stays up rather than one with a client drawn
+            // stretched or cut, while the clients are still let to draw.
+            sendSuspendedFrameCallbacks();
+            break;
+        }
+        if (!updatePassthrough()) {
+            render();
+        }
+        break;
     default:
-        return QOpenGLWindow::event(e);
+        return QWindow::event(e);
     }
     return true;
 }
@@ -316,7 +896,8 @@ void Window::closeEvent(QCloseEvent *e)
 {
     Q_UNUSED(e);
     if (!m_views.empty()) {
-        View *view = m_views.first();
+        View *view = (m_currentToplevel ? m_currentToplevel.data()
+                                        : m_views.first());
         view->sendClose();
         e->ignore();
         m_compositor->setShowAgainWindow(this);
@@ -324,42 +905,190 @@ void Window::closeEvent(QCloseEvent *e)
     }
 }
 
+void Window::exposeEvent(QExposeEvent *e)
+{
+    Q_UNUSED(e);
+    setSuspended(!isExposed());
+    if (isExposed()) {
+        m_damage = QRect(QPoint(), size());
+        if (!updatePassthrough()) {
+            render();
+        }
+    }
+}
+
 void Window::resizeEvent(QResizeEvent *e)
 {
     updateOutputMode();
-    QOpenGLWindow::resizeEvent(e);
+    QWindow::resizeEvent(e);
 }
 
 void Window::showEvent(QShowEvent *e)
 {
     updateOutputMode();
-    QOpenGLWindow::showEvent(e);
+    QWindow::showEvent(e);
 }
 
-View *Window::viewAt(const QPointF &point) const
+View *Window::viewAt(const QPointF &point)
 {
+    if (!m_inputIndexValid) {
+        m_inputIndex.resize(0);
+        m_inputIndex.reserve(m_views.size());
+        for (View *view : qAsConst(m_views)) {
+            m_inputIndex.append({view->inputBounds(), view});
+        }
+        m_inputIndexValid = true;
+    }
     const QPointF mappedPoint = mapInputPoint(point);
-    const QVector<View *> views = m_views;
-    for (auto i = views.crbegin(), end = views.crend(); i != end; ++i) {
-        View *view = *i;
-        QWaylandSurface *surface = view->surface();
-        if (surface && surface->hasContent()) {
-            QRectF geom(view->position(), surface->destinationSize());
-            if (geom.contains(mappedPoint)) {
-                return view;
-            }
+    for (auto i = m_inputIndex.crbegin(), end = m_inputIndex.crend();
+         i != end; ++i) {
+        if (!i->bounds.contains(mappedPoint)) {
+            continue;
+        }
+        View *view = i->view;
+        if (view->acceptsInput(mappedPoint) &&
+                m_compositor->surfaceHasContent(view->surface())) {
+            return view;
         }
     }
     return nullptr;
 }
 
+void Window::invalidateInputIndex()
+{
+    m_inputIndexValid = false;
+}
+
+void Window::onViewInputBoundsChanged()
+{
+    if (!m_inputIndexValid) {
+        return;
+    }
+    auto *view = qobject_cast<View *>(sender());
+    for (InputEntry &entry : m_inputIndex) {
+        if (entry.view == view) {
+            entry.bounds = view->inputBounds();
+            return;
+        }
+    }
+}
+
 QPointF Window::mapInputPoint(const QPointF &point) const
 {
     return m_inverseTransform.map(point);
 }
 
+bool Window::coalescesPointer(View *view)
+{
+    // Comma-separated app ids of clients that get every motion event.
+    static const QStringList rawPointerAppIds =
+            qEnvironmentVariable("NEWCOMPOSITOR_RAW_POINTER_APPS")
+            .split(QLatin1Char(','), Qt::SkipEmptyParts);
+    return !rawPointerAppIds.contains(view->appId());
+}
+
+void Window::setPendingPointerView(View *view, QWaylandSeat *seat)
+{
+    if (view != m_pointerView || seat != m_pointerSeat) {
+        // Events for another surface must not be reordered around it.
+        flushPointer();
+        m_wheelRemainder = QPoint();
+        m_pointerView = view;
+        m_pointerSeat = seat;
+    }
+    scheduleInputFlush();
+}
+
+void Window::scheduleInputFlush()
+{
+    if (!m_inputFlushTimer.isActive()) {
+        const qint64 refreshPeriod = m_repaintScheduler->refreshPeriod();
+        m_inputFlushTimer.start(int(qMax<qint64>(1, refreshPeriod / 1000000)));
+    }
+}
+
+void Window::flushInput()
+{
+    m_inputFlushTimer.stop();
+    flushPointer();
+    flushTouch();
+}
+
+void Window::flushPointer()
+{
+    View *view = m_pointerView;
+    if (view && view->surface() && (m_pointerMotionPending ||
+                                     !m_pendingAngleDelta.isNull())) {
+        TraceSpan span("flushPointer", view->surface());
+        if (m_pointerMotionPending ||
+                m_pointerSeat->mouseFocus() != view) {
+            m_pointerSeat->sendMouseMoveEvent(view, m_pointerPosition);
+        }
+        if (!m_pendingAngleDelta.isNull()) {
+            sendAxisEvents(m_pointerSeat, view, m_pendingAngleDelta);
+        }
+    }
+    m_pointerMotionPending = false;
+    m_pendingAngleDelta = QPoint();
+    if (m_coalescedPointerEvents) {
+        m_statistics.recordCoalescedEvents(m_coalescedPointerEvents);
+        Trace::counter("coalescedPointerEvents", m_coalescedPointerEvents);
+        m_coalescedPointerEvents = 0;
+    }
+}
+
+void Window::sendAxisEvents(QWaylandSeat *seat, View *view,
+                            const QPoint &angleDelta)
+{
+    // QWaylandSeat::sendMouseWheelEvent() sends one axis at a time, without
+    // its source or discrete steps, so the events are sent here, as a
+    // single frame. High resolution steps need a newer wl_seat than
+    // QtWaylandCompositor implements; clients get whole steps, and the
+    // exact distance in the axis value.
+    m_wheelRemainder += angleDelta;
+    const QPoint steps(m_wheelRemainder.x() / 120, m_wheelRemainder.y() / 120);
+    m_wheelRemainder -= steps * 120;
+
+    auto *pointer = QWaylandPointerPrivate::get(seat->pointer());
+    wl_client *client = view->surface()->client()->client();
+    const uint32_t time = m_compositor->currentTimeMsecs();
+    const auto resources = pointer->resourceMap().values(client);
+    for (QtWaylandServer::wl_pointer::Resource *resource : resources) {
+        const int version = wl_resource_get_version(resource->handle);
+        if (version >= WL_POINTER_AXIS_SOURCE_SINCE_VERSION) {
+            pointer->send_axis_source(resource->handle,
+                                      QtWaylandServer::wl_pointer::axis_source_wheel);
+        }
+        // Qt counts eighths of a degree up and left, Wayland 10 units a
+        // step down and right.
+        const struct {
+            int delta;
+            int steps;
+            uint32_t axis;
+        } axes[] = {
+            { angleDelta.y(), steps.y(), QtWaylandServer::wl_pointer::axis_vertical_scroll },
+            { angleDelta.x(), steps.x(), QtWaylandServer::wl_pointer::axis_horizontal_scroll },
+        };
+        for (const auto &axis : axes) {
+            if (!axis.delta) {
+                continue;
+            }
+            if (axis.steps && version >= WL_POINTER_AXIS_DISCRETE_SINCE_VERSION) {
+                pointer->send_axis_discrete(resource->handle, axis.axis,
+                                            -axis.steps);
+            }
+            pointer->send_axis(resource->handle, time, axis.axis,
+                               wl_fixed_from_double(-axis.delta / 12.0));
+        }
+        if (version >= WL_POINTER_FRAME_SINCE_VERSION) {
+            pointer->send_frame(resource->handle);
+        }
+    }
+}
+
 void Window::mousePressEvent(QMouseEvent *e)
 {
+    flushPointer();
     if (m_mouseView.isNull()) {
         m_mouseView = viewAt(e->localPos());
         if (!m_mouseView) {
@@ -368,6 +1097,9 @@ void Window::mousePressEvent(QMouseEvent *e)
         QMouseEvent moveEvent(QEvent::MouseMove, e->localPos(), e->globalPos(),
                               Qt::NoButton, Qt::NoButton, e->modifiers());
         mouseMoveEvent(&moveEvent);
+        // The view must have the pointer focus before the button goes to
+        // it, not when the coalesced motion is flushed.
+        flushPointer();
     }
     m_compositor->seatFor(e)->sendMousePressEvent(e->button());
     QWaylandSurface *surface = m_mouseView->surface();
@@ -376,6 +1108,8 @@ void Window::mousePressEvent(QMouseEvent *e)
 
 void Window::mouseReleaseEvent(QMouseEvent *e)
 {
+    // Buttons never overtake pending motion.
+    flushPointer();
     m_compositor->seatFor(e)->sendMouseReleaseEvent(e->button());
     if (e->buttons() == Qt::NoButton) {
         m_mouseView = nullptr;
@@ -391,11 +1125,44 @@ void Window::mouseMoveEvent(QMouseEvent *e)
         view = viewAt(e->localPos());
     }
     if (!view) {
+        flushPointer();
         setCursor(Qt::ArrowCursor);
         return;
     }
     QPointF mappedPos = mapInputPoint(e->localPos()) - view->position();
-    m_compositor->seatFor(e)->sendMouseMoveEvent(view, mappedPos);
+    QWaylandSeat *seat = m_compositor->seatFor(e);
+    if (!coalescesPointer(view)) {
+        flushPointer();
+        seat->sendMouseMoveEvent(view, mappedPos);
+        return;
+    }
+    setPendingPointerView(view, seat);
+    if (m_pointerMotionPending) {
+        m_coalescedPointerEvents++;
+    }
+    m_pointerPosition = mappedPos;
+    m_pointerMotionPending = true;
+}
+
+void Window::wheelEvent(QWheelEvent *e)
+{
+    View *view = (m_mouseView ? m_mouseView.data() : viewAt(e->position()));
+    if (!view) {
+        return;
+    }
+    QWaylandSeat *seat = m_compositor->seatFor(e);
+    if (view != m_pointerView) {
+        flushPointer();
+        m_pointerPosition = mapInputPoint(e->position()) - view->position();
+    }
+    setPendingPointerView(view, seat);
+    if (!m_pendingAngleDelta.isNull()) {
+        m_coalescedPointerEvents++;
+    }
+    m_pendingAngleDelta += e->angleDelta();
+    if (!coalescesPointer(view)) {
+        flushPointer();
+    }
 }
 
 void Window::keyPressEvent(QKeyEvent *e)
@@ -408,30 +1175,104 @@ void Window::keyReleaseEvent(QKeyEvent *e)
     m_compositor->seatFor(e)->sendFullKeyEvent(e);
 }
 
+typedef QVarLengthArray<QWaylandClient *, 10> ClientList;
+
+static void addClient(ClientList &clients, QWaylandClient *client)
+{
+    if (std::find(clients.cbegin(), clients.cend(), client) == clients.cend()) {
+        clients.append(client);
+    }
+}
+
 void Window::touchEvent(QTouchEvent *e)
 {
     bool unhandled = false;
     QWaylandSeat *seat = m_compositor->seatFor(e);
-    QSet<QWaylandClient *> clients;
+    // Without allocating, as there can be many of these a frame.
+    ClientList clients;
+    if (e->type() == QEvent::TouchCancel) {
+        for (const TouchBinding &binding : qAsConst(m_touchViews)) {
+            if (binding.view && binding.view->surface()) {
+                addClient(clients, binding.view->surface()->client());
+            }
+            m_touchResampler.release(binding.id);
+        }
+        for (QWaylandClient *client : clients) {
+            seat->sendTouchCancelEvent(client);
+        }
+        m_touchViews.clear();
+        return;
+    }
+
+    // Resampled motion is sent once a frame, but presses and releases are
+    // sent as they come, after any pending motion.
+    const bool resampling = TouchResampler::isEnabled();
+    const qint64 time = (resampling ? qint64(PresentationTime::now()) : 0);
+    if (resampling && e->touchPointStates() & (Qt::TouchPointPressed |
+                                                Qt::TouchPointReleased)) {
+        flushTouch();
+    }
+    m_touchSeat = seat;
+
     for (const QTouchEvent::TouchPoint &p : e->touchPoints()) {
-        QPointF pos = p.pos();
-        View *view = viewAt(pos);
-        if (!view) {
+        const Qt::TouchPointState state = p.state();
+        if (state == Qt::TouchPointStationary) {
+            continue;
+        }
+        int binding = 0;
+        while (binding < m_touchViews.size() &&
+               m_touchViews.at(binding).id != p.id()) {
+            binding++;
+        }
+        View *view;
+        bool resampled = false;
+        if (state == Qt::TouchPointPressed) {
+            view = viewAt(p.pos());
+            if (binding == m_touchViews.size()) {
+                m_touchViews.append({p.id(), view, false, false});
+            } else {
+                m_touchViews[binding] = {p.id(), view, false, false};
+            }
+            if (resampling) {
+                m_touchResampler.press(p.id(), p.pos(), e->timestamp(), time);
+            }
+        } else if (binding < m_touchViews.size()) {
+            TouchBinding &touchBinding = m_touchViews[binding];
+            view = touchBinding.view;
+            if (state == Qt::TouchPointReleased) {
+                resampled = touchBinding.resampled;
+                m_touchViews.remove(binding);
+                m_touchResampler.release(p.id());
+            } else if (resampling) {
+                m_touchResampler.move(p.id(), p.pos(), e->timestamp(), time);
+                touchBinding.motionPending = true;
+                scheduleInputFlush();
+                continue;
+            }
+        } else {
+            continue;
+        }
+        if (!view || !view->surface()) {
             continue;
         }
-        QPointF mappedPos = mapInputPoint(pos);
+        QPointF mappedPos = mapInputPoint(p.pos());
         mappedPos -= view->position();
+        if (resampled) {
+            // The release is where the point really was.
+            seat->sendTouchPointEvent(view->surface(), p.id(), mappedPos,
+                                      Qt::TouchPointMoved);
+        }
         uint serial = seat->sendTouchPointEvent(view->surface(), p.id(),
-                                                mappedPos, p.state());
-        if (serial == 0 && (p.state() == Qt::TouchPointPressed ||
-                            p.state() == Qt::TouchPointReleased)) {
+                                                mappedPos, state);
+        if (serial == 0 && (state == Qt::TouchPointPressed ||
+                            state == Qt::TouchPointReleased)) {
             unhandled = true;
         } else {
-            if (p.state() == Qt::TouchPointReleased) {
+            if (state == Qt::TouchPointReleased) {
                 m_compositor->setFocusSurface(view->surface());
             }
         }
-        clients.insert(view->surface()->client());
+        addClient(clients, view->surface()->client());
     }
     for (QWaylandClient *client : clients) {
         seat->sendTouchFrameEvent(client);
@@ -441,3 +1282,31 @@ void Window::touchEvent(QTouchEvent *e)
         e->ignore();
     }
 }
+
+void Window::flushTouch()
+{
+    if (!m_touchSeat) {
+        return;
+    }
+    const qint64 time = PresentationTime::now();
+    ClientList clients;
+    for (TouchBinding &binding : m_touchViews) {
+        if (!binding.motionPending) {
+            continue;
+        }
+        binding.motionPending = false;
+        View *view = binding.view;
+        if (!view || !view->surface()) {
+            continue;
+        }
+        const QPointF position = m_touchResampler.resample(binding.id, time);
+        m_touchSeat->sendTouchPointEvent(view->surface(), binding.id,
+                                         mapInputPoint(position) - view->position(),
+                                         Qt::TouchPointMoved);
+        binding.resampled = true;
+        addClient(clients, view->surface()->client());
+    }
+    for (QWaylandClient *client : clients) {
+        m_touchSeat->sendTouchFrameEvent(client);
+    }
+}
@@ -51,57 +51,96 @@
 #ifndef WINDOW_H
 #define WINDOW_H
 
-#include <QOpenGLWindow>
-#include <QOpenGLTexture>
-#include <QOpenGLTextureBlitter>
+#include <QElapsedTimer>
 #include <QPointer>
+#include <QRectF>
+#include <QRegion>
 #include <QTimer>
 #include <QTransform>
+#include <QVarLengthArray>
 #include <QVector>
+#include <QWaylandBufferRef>
+#include <QWindow>
+
+#include "framestatistics.h"
+#include "presentationtime.h"
+#include "renderer.h"
+#include "touchresampler.h"
 
 QT_BEGIN_NAMESPACE
 
 class QCloseEvent;
 class QEvent;
+class QExposeEvent;
 class QKeyEvent;
 class QMouseEvent;
+class QOpenGLContext;
 class QResizeEvent;
 class QScreen;
 class QShowEvent;
 class QTouchEvent;
+class QWaylandSeat;
+class QWheelEvent;
 
 class Compositor;
+class Passthrough;
+class RenderThread;
+class RepaintScheduler;
 class View;
 
-class Window : public QOpenGLWindow
+class Window : public QWindow
 {
     Q_OBJECT
 public:
     Window(Compositor *compositor);
-
-    static void deletePendingWindows();
+    ~Window();
 
     void addView(View *view);
     QVector<View *> views() const { return m_views; }
 
+    // The toplevel shown with its popups and transients. A window shared by
+    // several toplevels only shows the one on top, the others are hidden and
+    // suspended.
+    View *currentToplevel() const { return m_currentToplevel; }
+    void raiseToplevel(View *view);
+    // Raises the toplevel shown before the current one, if there is one.
+    void showPreviousToplevel();
+
+    // Frees the textures of the views that are not shown, which are
+    // uploaded again when they are.
+    void releaseHiddenTextures();
+
+    void damageAll();
+    void scheduleRepaint();
+    RepaintScheduler *repaintScheduler() const { return m_repaintScheduler; }
+    FrameStatistics &statistics() { return m_statistics; }
+
+    // Surfaces are laid out in logical coordinates, which are scaled to
+    // the pixels of the window.
+    qreal scale() const { return m_scale; }
+    // The logical size of the output, without the keyboard.
+    QSize outputSize() const { return m_outputSize; }
+    // Derived from the density of the screen, or set with
+    // NEWCOMPOSITOR_SCALE.
+    static qreal scaleForScreen(QScreen *screen);
+
 signals:
     void rotationChanged(int rotation);
+    void outputSizeChanged();
 
 protected:
-    void initializeGL() override;
-    void resizeGL(int w, int h) override;
-    void paintGL() override;
-
     bool event(QEvent *e) override;
 
     void closeEvent(QCloseEvent *e);
 
+    void exposeEvent(QExposeEvent *e) override;
     void resizeEvent(QResizeEvent *e) override;
     void showEvent(QShowEvent *e) override;
 
     void mousePressEvent(QMouseEvent *e) override;
     void mouseReleaseEvent(QMouseEvent *e) override;
     void mouseMoveEvent(QMouseEvent *e) override;
+    void wheelEvent(QWheelEvent *e) override;
 
     void keyPressEvent(QKeyEvent *e) override;
     void keyReleaseEvent(QKeyEvent *e) override;
@@ -110,33 +149,133 @@ protected:
 
 private slots:
     void viewSurfaceDestroyed();
+    void onViewInputBoundsChanged();
     void onKeyboardRect(bool active, int x, int y, int width, int height);
     void onScreenChanged(QScreen *screen);
     void onScreenOrientationChanged(Qt::ScreenOrientation orientation);
+    void onFramePresented();
+    void onFrameSwapped(qint64 renderTime, qint64 gpuTime);
 
 private:
     void updateOutputMode();
+    void setSuspended(bool suspended);
+    void sendSuspendedFrameCallbacks();
+    void sendFrameDrawn(quint64 timestamp);
+    bool isResizePending() const;
+    View *toplevelOf(View *view) const;
 
     void showAgain();
 
-    View *viewAt(const QPointF &point) const;
+    View *viewAt(const QPointF &point);
+    void invalidateInputIndex();
     void sendMouseEvent(QMouseEvent *e, View *view);
 
     QPointF mapInputPoint(const QPointF &point) const;
 
-    static QVector<Window *> m_windowsToDelete;
+    void setPendingPointerView(View *view, QWaylandSeat *seat);
+    void scheduleInputFlush();
+    void flushInput();
+    void flushPointer();
+    void flushTouch();
+    void sendAxisEvents(QWaylandSeat *seat, View *view, const QPoint &angleDelta);
+    static bool coalescesPointer(View *view);
+
+    bool makeCurrent();
+
+    void render();
+    void collectDamage(const QRect &viewportRect);
+    RenderFrame prepareFrame();
+    void recordFrame(qint64 paintTime, qint64 gpuTime);
+
+    View *passthroughView() const;
+    bool updatePassthrough();
+    void stopPassthrough();
 
-    QOpenGLTextureBlitter m_textureBlitter;
-    QOpenGLTexture *m_backgroundTexture;
     Compositor *m_compositor;
+    // In stacking order, with the views of the current toplevel on top.
     QVector<View *> m_views;
+    QPointer<View> m_currentToplevel;
     QPointer<View> m_mouseView;
 
+    // The input bounds of the views, in stacking order, which hit-testing
+    // walks before looking at any view. Entries are updated as their views
+    // move or commit, and the index is rebuilt when the stacking changes.
+    struct InputEntry
+    {
+        QRectF bounds;
+        View *view;
+    };
+    QVector<InputEntry> m_inputIndex;
+    bool m_inputIndexValid = false;
+
+    // The view each touch point went down on, which gets the rest of its
+    // events.
+    struct TouchBinding
+    {
+        int id;
+        QPointer<View> view;
+        // With resampling, motion not yet sent, and whether the client was
+        // last sent a resampled position.
+        bool motionPending;
+        bool resampled;
+    };
+    QVarLengthArray<TouchBinding, 10> m_touchViews;
+    QWaylandSeat *m_touchSeat = nullptr;
+    TouchResampler m_touchResampler;
+
+    // Pointer motion and scrolling not yet sent, as they are sent to
+    // clients at most once a frame.
+    QPointer<View> m_pointerView;
+    QWaylandSeat *m_pointerSeat = nullptr;
+    QPointF m_pointerPosition;
+    bool m_pointerMotionPending = false;
+    QPoint m_pendingAngleDelta;
+    // Scrolling less than a wheel step, in eighths of a degree.
+    QPoint m_wheelRemainder;
+    int m_coalescedPointerEvents = 0;
+    // Flushes pending input a refresh after it came, when the window is not
+    // updated before that.
+    QTimer m_inputFlushTimer;
+
     QPointer<QScreen> m_previousScreen;
     int m_rotation = 0;
+    qreal m_scale = 1;
+    QSize m_outputSize;
+    // From logical coordinates to the window, and back.
     QTransform m_transform;
     QTransform m_inverseTransform;
-    int m_keyboardHeight;
+    int m_keyboardHeight = 0;
+
+    // Damage accumulated for the next frame.
+    QRegion m_damage;
+
+    // Either the window is drawn on the main thread with m_context, or on
+    // m_renderThread.
+    QOpenGLContext *m_context = nullptr;
+    Renderer m_renderer;
+    RenderThread *m_renderThread = nullptr;
+    // A frame is being drawn on the render thread, and the buffers it uses
+    // must not be released until it is done.
+    bool m_frameInFlight = false;
+    bool m_renderPending = false;
+    QVector<QWaylandBufferRef> m_inFlightBuffers;
+    QElapsedTimer m_paintTimer;
+    qint64 m_prepareTime = 0;
+    FrameStatistics m_statistics;
+
+    // Not exposed on the host, so not drawn, and clients are only let to
+    // draw a frame every now and then.
+    bool m_suspended = false;
+    QTimer m_suspendedFrameTimer;
+    // Textures of views hidden for a while are freed.
+    QTimer m_hiddenTextureTimer;
+
+    Passthrough *m_passthrough = nullptr;
+    RepaintScheduler *m_repaintScheduler;
+
+    // Feedback for the contents in the frame being presented.
+    PresentationFeedbackList m_presentationFeedback;
+    quint64 m_frameSequence = 0;
 };
 
 QT_END_NAMESPACE
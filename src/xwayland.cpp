@@ -1,63 +1,289 @@
 #include "xwayland.h"
 
 #include <QDebug>
+#include <QDir>
 #include <QFile>
 #include <QSocketNotifier>
+#include <QWaylandClient>
 #include <QWaylandCompositor>
 #include <cerrno>
+#include <cstddef>
+#include <cstdio>
 #include <cstring>
 #include <fcntl.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
 
+static const int maxDisplay = 32;
+
+static QByteArray socketPath(int display)
+{
+    return "/tmp/.X11-unix/X" + QByteArray::number(display);
+}
+
+static QByteArray lockPath(int display)
+{
+    return "/tmp/.X" + QByteArray::number(display) + "-lock";
+}
+
 Xwayland::Xwayland(QWaylandCompositor *compositor)
     : QProcess(compositor)
     , m_compositor(compositor)
-    , m_displayName(":")
 {
     setProcessChannelMode(QProcess::ForwardedChannels);
     setProgram("Xwayland");
+
+    connect(this, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, &Xwayland::onServerFinished);
+    connect(this, &QProcess::errorOccurred,
+            this, [this](QProcess::ProcessError error) {
+        if (error == QProcess::FailedToStart) {
+            qCritical() << "error starting Xwayland:" << errorString();
+            onServerFinished();
+        }
+    });
+
+    // In seconds; by default the server is kept running.
+    const int idleTimeout =
+            qEnvironmentVariableIntValue("NEWCOMPOSITOR_XWAYLAND_IDLE_TIMEOUT");
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(idleTimeout * 1000);
+    connect(&m_idleTimer, &QTimer::timeout, this, &Xwayland::stopServer);
 }
 
 Xwayland::~Xwayland()
 {
+    // The window manager cleans up after itself when it is destroyed.
+    disconnect(this, nullptr, this, nullptr);
     if (m_wlClient) {
         ::wl_client_destroy(m_wlClient);
     }
+    if (state() != QProcess::NotRunning) {
+        kill();
+        waitForFinished();
+    }
+    for (int fd : m_listenFds) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    if (m_display >= 0) {
+        ::unlink(socketPath(m_display).constData());
+        unlockDisplay();
+    }
+    if (!m_displayFile.isEmpty()) {
+        QFile::remove(m_displayFile);
+    }
+}
+
+bool Xwayland::listen()
+{
+    ::mkdir("/tmp/.X11-unix", 01777);
+    for (int display = 0; display < maxDisplay; display++) {
+        if (!lockDisplay(display)) {
+            continue;
+        }
+        // Clients try the abstract socket first, but the file system one
+        // is needed by those in other network namespaces.
+        const QByteArray path = socketPath(display);
+        m_listenFds[0] = bindSocket(path, true);
+        if (m_listenFds[0] < 0) {
+            unlockDisplay();
+            continue;
+        }
+        m_listenFds[1] = bindSocket(path, false);
+        if (m_listenFds[1] < 0) {
+            ::close(m_listenFds[0]);
+            m_listenFds[0] = -1;
+            unlockDisplay();
+            continue;
+        }
+
+        m_displayName = ":" + QByteArray::number(display);
+        for (int i = 0; i < 2; i++) {
+            m_listenNotifiers[i] = new QSocketNotifier(
+                        m_listenFds[i], QSocketNotifier::Read, this);
+            connect(m_listenNotifiers[i], &QSocketNotifier::activated,
+                    this, &Xwayland::startServer);
+        }
+        advertiseDisplay();
+        qInfo("Xwayland will start on demand on DISPLAY=%s",
+              m_displayName.constData());
+        return true;
+    }
+    qCritical("error claiming an X display for Xwayland");
+    return false;
+}
+
+bool Xwayland::lockDisplay(int display)
+{
+    const QByteArray path = lockPath(display);
+    int fd = ::open(path.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                    0444);
+    if (fd < 0 && errno == EEXIST) {
+        // Take the lock over from a server that is gone.
+        QFile lock(QString::fromLocal8Bit(path));
+        if (!lock.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        const pid_t pid = lock.readAll().trimmed().toInt();
+        lock.close();
+        if (pid <= 0 || ::kill(pid, 0) == 0 || errno != ESRCH) {
+            return false;
+        }
+        if (::unlink(path.constData()) != 0) {
+            return false;
+        }
+        fd = ::open(path.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                    0444);
+    }
+    if (fd < 0) {
+        return false;
+    }
+
+    char pid[12];
+    ::snprintf(pid, sizeof(pid), "%10d\n", int(::getpid()));
+    if (::write(fd, pid, sizeof(pid) - 1) != sizeof(pid) - 1) {
+        qWarning() << "error writing X display lock file:"
+                   << ::strerror(errno);
+        ::close(fd);
+        ::unlink(path.constData());
+        return false;
+    }
+    ::close(fd);
+    m_display = display;
+    return true;
+}
+
+void Xwayland::unlockDisplay()
+{
+    ::unlink(lockPath(m_display).constData());
+    m_display = -1;
+}
+
+int Xwayland::bindSocket(const QByteArray &path, bool abstract)
+{
+    // Not close-on-exec, as the socket is handed over to Xwayland.
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        qWarning() << "error creating X display socket:" << ::strerror(errno);
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    const int offset = (abstract ? 1 : 0);
+    ::memcpy(addr.sun_path + offset, path.constData(), path.size());
+    socklen_t size = offsetof(struct sockaddr_un, sun_path) + offset
+            + path.size();
+    if (!abstract) {
+        // The display is locked, so any socket left there is stale.
+        ::unlink(path.constData());
+        size++;
+    }
+
+    if (::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), size) != 0 ||
+            ::listen(fd, 1) != 0) {
+        if (errno != EADDRINUSE) {
+            qWarning() << "error binding X display socket:"
+                       << ::strerror(errno);
+        }
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void Xwayland::advertiseDisplay()
+{
+    qputenv("DISPLAY", m_displayName);
+
+    // Written next to the Wayland socket, for qt-runner.
+    const QByteArray runtimeDir = qgetenv("XDG_RUNTIME_DIR");
+    const QString socketName = QString::fromUtf8(m_compositor->socketName());
+    if (runtimeDir.isEmpty() || socketName.isEmpty()) {
+        return;
+    }
+    m_displayFile = QDir(QString::fromLocal8Bit(runtimeDir))
+            .filePath(socketName + QStringLiteral("-x11-display"));
+    QFile file(m_displayFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+            file.write(m_displayName + '\n') < 0) {
+        qWarning() << "error advertising X display:" << file.errorString();
+        m_displayFile.clear();
+    }
 }
 
-void Xwayland::start()
+static void closeFds(const int fds[2])
 {
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+void Xwayland::startServer()
+{
+    if (m_running) {
+        return;
+    }
     int waylandFd[2];
-    if (socketpair(AF_UNIX, SOCK_STREAM, 0, waylandFd) != 0) {
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, waylandFd) != 0) {
         qCritical() << "error creating Xwayland Wayland client socket pair:"
                     << ::strerror(errno);
         return;
     }
-    m_wlClient = ::wl_client_create(m_compositor->display(), waylandFd[0]);
-
     int wmFd[2];
-    if (socketpair(AF_UNIX, SOCK_STREAM, 0, wmFd) != 0) {
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, wmFd) != 0) {
         qCritical() << "error creating Xwayland XWM socket pair:"
                     << ::strerror(errno);
+        closeFds(waylandFd);
         return;
     }
-    m_wmFd = wmFd[0];
-
     int displayFd[2];
     if (::pipe(displayFd) != 0) {
         qCritical() << "error creating Xwayland display pipe:"
                     << ::strerror(errno);
+        closeFds(waylandFd);
+        closeFds(wmFd);
+        return;
+    }
+    // Only the ends for Xwayland are to be inherited.
+    for (int fd : {waylandFd[0], wmFd[0], displayFd[0]}) {
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    m_wlClient = ::wl_client_create(m_compositor->display(), waylandFd[0]);
+    if (!m_wlClient) {
+        qCritical("error creating Xwayland Wayland client");
+        closeFds(waylandFd);
+        closeFds(wmFd);
+        closeFds(displayFd);
         return;
     }
-    auto *notifier = new QSocketNotifier(displayFd[0], QSocketNotifier::Read,
-                                         this);
-    connect(notifier, &QSocketNotifier::activated,
+
+    // Xwayland accepts the connection that is waiting.
+    for (QSocketNotifier *notifier : m_listenNotifiers) {
+        notifier->setEnabled(false);
+    }
+    // Xwayland may exit on its own, taking its client with it.
+    connect(QWaylandClient::fromWlClient(m_compositor, m_wlClient),
+            &QObject::destroyed, this, [this] { m_wlClient = nullptr; });
+    m_wmFd = wmFd[0];
+    m_displayNotifier = new QSocketNotifier(displayFd[0],
+                                            QSocketNotifier::Read, this);
+    connect(m_displayNotifier, &QSocketNotifier::activated,
             this, &Xwayland::displayPipeReadyRead);
 
     setArguments(QStringList()
+                 << QString::fromLatin1(m_displayName)
                  << "-rootless"
+                 << "-listenfd"
+                 << QString::number(m_listenFds[0])
+                 << "-listenfd"
+                 << QString::number(m_listenFds[1])
                  << "-displayfd"
                  << QString::number(displayFd[1])
                  << "-wm"
@@ -65,6 +291,7 @@ void Xwayland::start()
     QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
     env.insert("WAYLAND_SOCKET", QString::number(waylandFd[1]));
     setProcessEnvironment(env);
+    m_running = true;
     QProcess::start();
 
     ::close(displayFd[1]);
@@ -72,27 +299,91 @@ void Xwayland::start()
     ::close(wmFd[1]);
 }
 
+void Xwayland::stopServer()
+{
+    qInfo("stopping idle Xwayland");
+    terminate();
+}
+
+void Xwayland::setIdle(bool idle)
+{
+    if (!m_ready || m_idleTimer.interval() <= 0) {
+        return;
+    }
+    if (idle) {
+        m_idleTimer.start();
+    } else {
+        m_idleTimer.stop();
+    }
+}
+
 void Xwayland::displayPipeReadyRead(int fd)
 {
-    auto *notifier = qobject_cast<QSocketNotifier *>(sender());
+    // The display is already known, so only the end of the line that
+    // Xwayland writes when it is ready matters.
+    char buffer[16];
+    const ssize_t size = ::read(fd, buffer, sizeof(buffer));
+    if (size < 0 && errno == EINTR) {
+        return;
+    }
+    const bool ready = (size > 0 && ::memchr(buffer, '\n', size));
+    if (size > 0 && !ready) {
+        return;
+    }
 
-    QFile displayPipe;
-    if (!displayPipe.open(fd, QIODevice::ReadOnly)) {
-        notifier->deleteLater();
-        qFatal("error opening Xwayland display pipe: %s",
-               qPrintable(displayPipe.errorString()));
+    m_displayNotifier->deleteLater();
+    m_displayNotifier = nullptr;
+    ::close(fd);
+    if (!ready) {
+        // Xwayland exited before it was ready.
         return;
     }
+    m_ready = true;
+    qInfo("Xwayland running on DISPLAY=%s", m_displayName.constData());
+    emit displayReady();
+    // Stopped if the client that started it never maps a window.
+    setIdle(true);
+}
 
-    const QByteArray out = displayPipe.readAll();
-    for (const char c : out) {
-        if (c == '\n') {
-            notifier->deleteLater();
-            displayPipe.close();
-            qInfo("Xwayland running on DISPLAY=%s", m_displayName.constData());
-            emit displayReady();
-            break;
+void Xwayland::onServerFinished()
+{
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+    m_idleTimer.stop();
+    if (m_displayNotifier) {
+        ::close(int(m_displayNotifier->socket()));
+        delete m_displayNotifier;
+        m_displayNotifier = nullptr;
+    }
+    // Once the display is ready, the window manager owns its socket.
+    const bool wasReady = m_ready;
+    if (!wasReady && m_wmFd >= 0) {
+        ::close(m_wmFd);
+    }
+    m_wmFd = -1;
+    m_ready = false;
+
+    emit stopped();
+    if (m_wlClient) {
+        ::wl_client_destroy(m_wlClient);
+        m_wlClient = nullptr;
+    }
+    if (!wasReady) {
+        // Refuse X clients rather than spawn a broken server for each.
+        qCritical("Xwayland exited before it was ready, refusing X clients");
+        for (int i = 0; i < 2; i++) {
+            delete m_listenNotifiers[i];
+            m_listenNotifiers[i] = nullptr;
+            ::close(m_listenFds[i]);
+            m_listenFds[i] = -1;
         }
-        m_displayName.append(c);
+        return;
+    }
+    qInfo("Xwayland exited, waiting for X clients on DISPLAY=%s",
+          m_displayName.constData());
+    for (QSocketNotifier *notifier : m_listenNotifiers) {
+        notifier->setEnabled(true);
     }
 }
@@ -3,34 +3,65 @@
 
 #include <QByteArray>
 #include <QProcess>
+#include <QString>
+#include <QTimer>
 
 QT_BEGIN_NAMESPACE
 
+class QSocketNotifier;
 class QWaylandCompositor;
 struct xcb_connection_t;
 struct wl_client;
 
+// Xwayland, started on demand. The X display is claimed and its sockets are
+// listened on by the compositor, and the server is only spawned, with the
+// sockets handed over, when the first X client connects. When the idle
+// timeout is set, the server is stopped again once it has had no windows
+// for that long, and spawned again by the next X client.
 class Xwayland : public QProcess
 {
     Q_OBJECT
 public:
     Xwayland(QWaylandCompositor *compositor);
     ~Xwayland();
-    void start();
+    // Claims an X display and advertises it as DISPLAY.
+    bool listen();
     QByteArray displayName() const { return m_displayName; }
     int wmFd() const { return m_wmFd; }
+    struct wl_client *client() const { return m_wlClient; }
+    // Whether the server has no windows; set by the window manager.
+    void setIdle(bool idle);
 
 signals:
     void displayReady();
+    // The server has exited and its windows are gone.
+    void stopped();
 
 private slots:
+    void startServer();
+    void stopServer();
     void displayPipeReadyRead(int fd);
+    void onServerFinished();
 
 private:
+    bool lockDisplay(int display);
+    void unlockDisplay();
+    int bindSocket(const QByteArray &path, bool abstract);
+    void advertiseDisplay();
+
     QWaylandCompositor *m_compositor;
     QByteArray m_displayName;
-    int m_wmFd;
-    struct wl_client *m_wlClient;
+    int m_display = -1;
+    // The abstract and the file system socket of the display.
+    int m_listenFds[2] = { -1, -1 };
+    QSocketNotifier *m_listenNotifiers[2] = { nullptr, nullptr };
+    QSocketNotifier *m_displayNotifier = nullptr;
+    QString m_displayFile;
+    bool m_running = false;
+    bool m_ready = false;
+    int m_wmFd = -1;
+    struct wl_client *m_wlClient = nullptr;
+    QTimer m_idleTimer;
 };
 
 QT_END_NAMESPACE
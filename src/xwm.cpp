@@ -1,20 +1,17 @@
 #include "xwm.h"
 
-#include <QDebug>
-#include <QList>
+#include <QCoreApplication>
+#include <QEvent>
 #include <QObject>
-#include <QProcess>
 #include <QPoint>
-#include <QSocketNotifier>
 #include <QString>
+#include <QWaylandClient>
 #include <QWaylandSurface>
 #include <QWaylandView>
-#include <stdlib.h>
-#include <xcb/composite.h>
-#include <xcb/xcb.h>
 #include <wayland-server.h>
 
 #include "compositor.h"
+#include "trace.h"
 #include "xwayland.h"
 #include "xwmwindow.h"
 
@@ -22,6 +19,7 @@ Xwm::Xwm(Compositor *compositor, Xwayland *xwayland)
     : QObject(compositor)
     , m_compositor(compositor)
     , m_xwayland(xwayland)
+    , m_connection(new XwmConnection)
 {
     connect(m_compositor, &Compositor::surfaceReady,
             this, &Xwm::onSurfaceReady);
@@ -29,354 +27,211 @@ Xwm::Xwm(Compositor *compositor, Xwayland *xwayland)
             this, &Xwm::onSurfaceAboutToBeDestroyed);
     connect(m_xwayland, &Xwayland::displayReady,
             this, &Xwm::initialize);
+    connect(m_xwayland, &Xwayland::stopped,
+            this, &Xwm::reset);
+
+    m_thread.setObjectName(QStringLiteral("xwm"));
+    m_connection->moveToThread(&m_thread);
+    connect(m_connection, &XwmConnection::eventsReady,
+            this, &Xwm::onEventsReady);
+    m_thread.start();
 }
 
 Xwm::~Xwm()
 {
-    if (m_conn) {
-        ::xcb_disconnect(m_conn);
-    }
+    QMetaObject::invokeMethod(m_connection, [this] {
+        m_connection->disconnectFromServer();
+    }, Qt::BlockingQueuedConnection);
+    m_thread.quit();
+    m_thread.wait();
+    delete m_connection;
 }
 
 void Xwm::initialize() {
-    m_conn = ::xcb_connect_to_fd(m_xwayland->wmFd(), NULL);
-    if (::xcb_connection_has_error(m_conn)) {
-        ::xcb_disconnect(m_conn);
-        qCritical("error connecting to Xwayland");
-        return;
-    }
-
-    m_notifier = new QSocketNotifier(::xcb_get_file_descriptor(m_conn),
-                                     QSocketNotifier::Read, this);
-    connect(m_notifier, &QSocketNotifier::activated,
-            this, &Xwm::processEvents);
-
-    m_atom_wlSurfaceId = internAtom("WL_SURFACE_ID");
-    m_atom_wmDeleteWindow = internAtom("WM_DELETE_WINDOW");
-    m_atom_wmProtocols = internAtom("WM_PROTOCOLS");
-
-    xcb_screen_iterator_t s = ::xcb_setup_roots_iterator(::xcb_get_setup(m_conn));
-    xcb_screen_t *screen = s.data;
-
-    const static uint32_t values[] = {(XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY |
-                                       XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT)};
-    ::xcb_change_window_attributes(m_conn, screen->root,
-                                   XCB_CW_EVENT_MASK, values);
-
-    ::xcb_composite_redirect_subwindows(m_conn, screen->root,
-                                        XCB_COMPOSITE_REDIRECT_MANUAL);
-
-    ::xcb_flush(m_conn);
+    const int fd = m_xwayland->wmFd();
+    QMetaObject::invokeMethod(m_connection, [this, fd] {
+        m_connection->connectToServer(fd);
+    }, Qt::QueuedConnection);
 }
 
-void Xwm::syncWindowProperties(xcb_window_t window)
+void Xwm::reset()
 {
-    const xcb_atom_t props[] = {XCB_ATOM_WM_TRANSIENT_FOR, m_atom_wmProtocols};
-    for (xcb_atom_t prop : props) {
-        readWindowProperty(window, prop);
-    }
-}
+    QMetaObject::invokeMethod(m_connection, [this] {
+        m_connection->disconnectFromServer();
+    }, Qt::BlockingQueuedConnection);
+    // Changes from the server that is gone may still be queued.
+    QCoreApplication::removePostedEvents(this, QEvent::MetaCall);
 
-xcb_atom_t Xwm::internAtom(const QByteArray &name)
-{
-    xcb_intern_atom_cookie_t cookie = ::xcb_intern_atom(m_conn, 0, strlen(name),
-                                                        name);
-    xcb_intern_atom_reply_t *reply = ::xcb_intern_atom_reply(m_conn, cookie,
-                                                             NULL);
-    xcb_atom_t atom = reply->atom;
-    ::free(reply);
-    return atom;
+    for (XwmWindow *xwmWindow : qAsConst(m_windows)) {
+        xwmWindow->deleteLater();
+    }
+    m_windows.clear();
+    m_surfaceWindows.clear();
+    m_surfaces.clear();
 }
 
 QWaylandSurface *Xwm::findSurface(uint32_t surfaceId) const
 {
-    const QList<QWaylandSurface *> surfaces = m_compositor->surfaces();
-    for (QWaylandSurface *surface : surfaces) {
-        if (surface->resource()->object.id == surfaceId) {
-            return surface;
-        }
-    }
-    return nullptr;
+    return m_surfaces.value(surfaceId);
 }
 
 QWaylandSurface *Xwm::surfaceForWindow(xcb_window_t window) const
 {
-    if (!m_windows.contains(window)) {
-        return nullptr;
-    }
-    return m_windows[window]->m_surface;
+    XwmWindow *xwmWindow = m_windows.value(window);
+    return (xwmWindow ? xwmWindow->m_surface : nullptr);
 }
 
 void Xwm::onSurfaceReady(QWaylandSurface *surface)
 {
+    // Surface ids are only unique within a client.
+    if (surface->client()->client() != m_xwayland->client()) {
+        return;
+    }
     uint32_t surfaceId = surface->resource()->object.id;
-    const QHash<xcb_window_t, XwmWindow*> windows = m_windows;
-    for (XwmWindow *xwmWindow : windows) {
-        if (xwmWindow->m_surfaceId == surfaceId) {
-            xwmWindow->setSurface(surface);
-            return;
-        }
+    m_surfaces.insert(surfaceId, surface);
+    XwmWindow *xwmWindow = m_surfaceWindows.value(surfaceId);
+    if (xwmWindow) {
+        xwmWindow->setSurface(surface);
     }
 }
 
 void Xwm::onSurfaceAboutToBeDestroyed(QWaylandSurface *surface)
 {
+    // The window stays indexed by the id, which Xwayland may reuse for the
+    // next surface of the window.
     uint32_t surfaceId = surface->resource()->object.id;
-    m_surfaceWindows.remove(surfaceId);
-}
-
-void Xwm::processEvents()
-{
-    int count = 0;
-    while (xcb_generic_event_t *event = ::xcb_poll_for_event(m_conn)) {
-        switch (event->response_type & ~0x80) {
-        case 0:
-            break;
-        case XCB_CREATE_NOTIFY:
-            handleCreateNotify(event);
-            break;
-        case XCB_DESTROY_NOTIFY:
-            handleDestroyNotify(event);
-            break;
-        case XCB_UNMAP_NOTIFY:
-            handleUnmapNotify(event);
-            break;
-        case XCB_MAP_NOTIFY:
-            handleMapNotify(event);
-            break;
-        case XCB_MAP_REQUEST:
-            handleMapRequest(event);
-            break;
-        case XCB_CONFIGURE_NOTIFY:
-            handleConfigureNotify(event);
-            break;
-        case XCB_CONFIGURE_REQUEST:
-            handleConfigureRequest(event);
-            break;
-        case XCB_PROPERTY_NOTIFY:
-            handlePropertyNotify(event);
-            break;
-        case XCB_CLIENT_MESSAGE:
-            handleClientMessage(event);
-            break;
-        case XCB_MAPPING_NOTIFY:
-            break;
-        default:
-            qDebug() << "Unknown event" << (event->response_type & ~0x80);
-        }
-        ::free(event);
-        count++;
-    }
-    if (count) {
-        ::xcb_flush(m_conn);
-    }
-}
-
-void Xwm::handleCreateNotify(xcb_generic_event_t *event)
-{
-    auto notify = reinterpret_cast<xcb_create_notify_event_t *>(event);
-    const xcb_window_t window = notify->window;
-    auto *xwmWindow = new XwmWindow(this, window);
-    xwmWindow->setOverrideRedirect(notify->override_redirect);
-    m_windows[window] = xwmWindow;
-    const static uint32_t values[] = {XCB_EVENT_MASK_PROPERTY_CHANGE};
-    ::xcb_change_window_attributes(m_conn, window, XCB_CW_EVENT_MASK, values);
-    ::xcb_flush(m_conn);
-    syncWindowProperties(window);
-}
-
-void Xwm::handleDestroyNotify(xcb_generic_event_t *event)
-{
-    auto notify = reinterpret_cast<xcb_destroy_notify_event_t *>(event);
-    if (!m_windows.contains(notify->window)) {
-        return;
-    }
-    m_windows[notify->window]->deleteLater();
-    m_windows.remove(notify->window);
-}
-
-void Xwm::handleMapRequest(xcb_generic_event_t *event)
-{
-    auto request = reinterpret_cast<xcb_map_request_event_t *>(event);
-    ::xcb_map_window(m_conn, request->window);
-}
-
-void Xwm::handleUnmapNotify(xcb_generic_event_t *event)
-{
-    auto notify = reinterpret_cast<xcb_unmap_notify_event_t *>(event);
-    if (!m_windows.contains(notify->window)) {
-        return;
+    if (m_surfaces.value(surfaceId) == surface) {
+        m_surfaces.remove(surfaceId);
     }
-    m_windows[notify->window]->setMapped(false);
 }
 
-void Xwm::handleMapNotify(xcb_generic_event_t *event)
+void Xwm::onEventsReady(const XwmEventList &events)
 {
-    auto notify = reinterpret_cast<xcb_map_notify_event_t *>(event);
-    if (!m_windows.contains(notify->window)) {
-        return;
+    TraceSpan span("xwmChanges");
+    const bool wasIdle = m_windows.isEmpty();
+    for (const XwmEvent &event : events) {
+        handleEvent(event);
     }
-    m_windows[notify->window]->setMapped(true);
-    m_windows[notify->window]->setOverrideRedirect(notify->override_redirect);
-}
-
-void Xwm::handleConfigureNotify(xcb_generic_event_t *event)
-{
-    auto notify = reinterpret_cast<xcb_configure_notify_event_t *>(event);
-    if (!m_windows.contains(notify->window)) {
-        return;
+    if (m_windows.isEmpty() != wasIdle) {
+        m_xwayland->setIdle(m_windows.isEmpty());
     }
-    m_windows[notify->window]->setPosition(QPoint(notify->x, notify->y));
-    m_windows[notify->window]->setOverrideRedirect(notify->override_redirect);
 }
 
-void Xwm::handleConfigureRequest(xcb_generic_event_t *event)
+void Xwm::handleEvent(const XwmEvent &event)
 {
-    auto request = reinterpret_cast<xcb_configure_request_event_t *>(event);
-    if (!m_windows.contains(request->window)) {
+    if (event.type == XwmEvent::Created) {
+        auto *xwmWindow = new XwmWindow(this, event.window);
+        xwmWindow->setOverrideRedirect(event.overrideRedirect);
+        m_windows[event.window] = xwmWindow;
         return;
     }
-    m_windows[request->window]->setPosition(QPoint(request->x, request->y));
-}
-
-void Xwm::handlePropertyNotify(xcb_generic_event_t *event)
-{
-    auto notify = reinterpret_cast<xcb_property_notify_event_t *>(event);
-    if (!m_windows.contains(notify->window)) {
+    XwmWindow *xwmWindow = m_windows.value(event.window);
+    if (!xwmWindow) {
         return;
     }
-    readWindowProperty(notify->window, notify->atom);
-}
-
-void Xwm::handleClientMessage(xcb_generic_event_t *event)
-{
-    auto message = reinterpret_cast<xcb_client_message_event_t *>(event);
-    if (!m_windows.contains(message->window)) {
-        return;
-    }
-    if (message->type == m_atom_wlSurfaceId) {
-        uint32_t surfaceId = message->data.data32[0];
-        XwmWindow *xwmWindow = m_windows[message->window];
-        xwmWindow->m_surfaceId = surfaceId;
-        QWaylandSurface *surface = findSurface(surfaceId);
-        // Surface may have been destroyed or may not exist yet.
-        if (surface) {
-            xwmWindow->setSurface(surface);
+    switch (event.type) {
+    case XwmEvent::Created:
+        break;
+    case XwmEvent::Destroyed:
+        m_windows.remove(event.window);
+        if (m_surfaceWindows.value(xwmWindow->m_surfaceId) == xwmWindow) {
+            m_surfaceWindows.remove(xwmWindow->m_surfaceId);
         }
+        xwmWindow->deleteLater();
+        break;
+    case XwmEvent::Mapped:
+        xwmWindow->setMapped(true);
+        xwmWindow->setOverrideRedirect(event.overrideRedirect);
+        break;
+    case XwmEvent::Unmapped:
+        xwmWindow->setMapped(false);
+        break;
+    case XwmEvent::Moved:
+        xwmWindow->setPosition(event.position);
+        xwmWindow->setOverrideRedirect(event.overrideRedirect);
+        break;
+    case XwmEvent::MoveRequested:
+        xwmWindow->setPosition(event.position);
+        break;
+    case XwmEvent::TitleChanged:
+        xwmWindow->setTitle(event.text);
+        break;
+    case XwmEvent::ClassNameChanged:
+        xwmWindow->setClassName(event.text);
+        break;
+    case XwmEvent::TransientForChanged:
+        if (event.value != xwmWindow->m_transientFor) {
+            xwmWindow->setTransientFor(event.value);
+        }
+        break;
+    case XwmEvent::SurfaceIdChanged:
+        setWindowSurfaceId(xwmWindow, event.value);
+        break;
+    case XwmEvent::SyncChanged:
+        xwmWindow->setSyncsResizes(event.value);
+        break;
+    case XwmEvent::ResizeDone:
+        xwmWindow->setResizeDone(event.value);
+        break;
+    case XwmEvent::FrameCompleted:
+        xwmWindow->m_frameCompleted = true;
+        break;
     }
 }
 
-void Xwm::readWindowProperty(xcb_window_t window, xcb_atom_t property)
+void Xwm::setWindowSurfaceId(XwmWindow *xwmWindow, uint32_t surfaceId)
 {
-    xcb_get_property_cookie_t cookie = ::xcb_get_property(m_conn, 0, window,
-                                                          property,
-                                                          XCB_ATOM_ANY,
-                                                          0, 2048);
-    xcb_get_property_reply_t *reply = ::xcb_get_property_reply(m_conn, cookie,
-                                                               NULL);
-    if (reply == nullptr) {
-        return;
+    if (m_surfaceWindows.value(xwmWindow->m_surfaceId) == xwmWindow) {
+        m_surfaceWindows.remove(xwmWindow->m_surfaceId);
     }
-    if (property == XCB_ATOM_WM_NAME) {
-        readWindowTitle(window, reply);
-    } else if (property == XCB_ATOM_WM_CLASS) {
-        readWindowClass(window, reply);
-    } else if (property == XCB_ATOM_WM_TRANSIENT_FOR) {
-        readWindowTransientFor(window, reply);
-    } else if (property == m_atom_wmProtocols) {
-        readWindowProtocols(window, reply);
+    xwmWindow->m_surfaceId = surfaceId;
+    m_surfaceWindows.insert(surfaceId, xwmWindow);
+    QWaylandSurface *surface = findSurface(surfaceId);
+    // Surface may have been destroyed or may not exist yet.
+    if (surface) {
+        xwmWindow->setSurface(surface);
     }
-    ::free(reply);
 }
 
-void Xwm::readWindowTitle(xcb_window_t window,
-                          xcb_get_property_reply_t *reply)
-{
-    int len = ::xcb_get_property_value_length(reply);
-    auto *title = reinterpret_cast<char *>(::xcb_get_property_value(reply));
-    m_windows[window]->setTitle(QString::fromLocal8Bit(title, len));
-}
-
-void Xwm::readWindowClass(xcb_window_t window,
-                          xcb_get_property_reply_t *reply)
-{
-    int len = ::xcb_get_property_value_length(reply);
-    auto *className = reinterpret_cast<char *>(::xcb_get_property_value(reply));
-    m_windows[window]->setClassName(QString::fromLocal8Bit(className, len));
-}
-
-void Xwm::readWindowTransientFor(xcb_window_t window,
-                                 xcb_get_property_reply_t *reply)
+void Xwm::closeWindow(xcb_window_t window)
 {
-    xcb_window_t transientFor = *reinterpret_cast<xcb_window_t *>(::xcb_get_property_value(reply));
-    m_windows[window]->setTransientFor(transientFor);
+    QMetaObject::invokeMethod(m_connection, [this, window] {
+        m_connection->closeWindow(window);
+    }, Qt::QueuedConnection);
 }
 
-void Xwm::readWindowProtocols(xcb_window_t window,
-                              xcb_get_property_reply_t *reply)
+void Xwm::raiseWindow(xcb_window_t window)
 {
-    m_windows[window]->m_protocols.clear();
-    // XXX: not sure if this is the way to do it.
-    uint32_t len = ::xcb_get_property_value_length(reply) / sizeof(xcb_atom_t);
-    auto *atoms = reinterpret_cast<xcb_atom_t *>(::xcb_get_property_value(reply));
-    for (uint32_t i = 0; i < len; i++) {
-        m_windows[window]->m_protocols.append(atoms[i]);
-    }
+    QMetaObject::invokeMethod(m_connection, [this, window] {
+        m_connection->raiseWindow(window);
+    }, Qt::QueuedConnection);
 }
 
-void Xwm::closeWindow(xcb_window_t window)
+void Xwm::setFocusWindow(xcb_window_t window)
 {
-    if (!m_windows.contains(window)) {
-        return;
-    }
-    bool supportsDelete = false;
-    const QVector<xcb_atom_t> protocols = m_windows[window]->m_protocols;
-    for (xcb_atom_t protocol : protocols) {
-        if (protocol == m_atom_wmDeleteWindow) {
-            supportsDelete = true;
-            break;
-        }
-    }
-    if (supportsDelete) {
-        xcb_client_message_data_t messageData = {0};
-        messageData.data32[0] = m_atom_wmDeleteWindow;
-        messageData.data32[1] = XCB_CURRENT_TIME;
-        xcb_client_message_event_t event = {
-            .response_type = XCB_CLIENT_MESSAGE,
-            .format = 32,
-            .sequence = 0,
-            .window = window,
-            .type = m_atom_wmProtocols,
-            .data = messageData
-        };
-        ::xcb_send_event(m_conn, 0, window, XCB_EVENT_MASK_NO_EVENT,
-                         reinterpret_cast<const char *>(&event));
-    } else {
-        ::xcb_kill_client(m_conn, window);
-    }
-    ::xcb_flush(m_conn);
+    QMetaObject::invokeMethod(m_connection, [this, window] {
+        m_connection->setFocusWindow(window);
+    }, Qt::QueuedConnection);
 }
 
-void Xwm::raiseWindow(xcb_window_t window)
+void Xwm::resizeWindow(xcb_window_t window, const QSize &size,
+                       uint32_t serial)
 {
-    uint16_t mask = XCB_CONFIG_WINDOW_STACK_MODE;
-    uint32_t values[] = {XCB_STACK_MODE_ABOVE};
-    ::xcb_configure_window(m_conn, window, mask, values);
-    ::xcb_flush(m_conn);
+    QMetaObject::invokeMethod(m_connection, [this, window, size, serial] {
+        m_connection->resizeWindow(window, size, serial);
+    }, Qt::QueuedConnection);
 }
 
-void Xwm::setFocusWindow(xcb_window_t window)
+void Xwm::sendFrameDrawn(xcb_window_t window, quint64 timestamp)
 {
-    ::xcb_set_input_focus(m_conn, XCB_INPUT_FOCUS_POINTER_ROOT, window,
-                          XCB_CURRENT_TIME);
-    ::xcb_flush(m_conn);
+    QMetaObject::invokeMethod(m_connection, [this, window, timestamp] {
+        m_connection->sendFrameDrawn(window, timestamp);
+    }, Qt::QueuedConnection);
 }
 
-void Xwm::resizeWindow(xcb_window_t window, const QSize &size)
+void Xwm::setWindowHidden(xcb_window_t window, bool hidden)
 {
-    uint16_t mask = (XCB_CONFIG_WINDOW_WIDTH |
-                     XCB_CONFIG_WINDOW_HEIGHT);
-    uint32_t values[] = {(uint32_t) size.width(), (uint32_t) size.height()};
-    ::xcb_configure_window(m_conn, window, mask, values);
-    ::xcb_flush(m_conn);
+    QMetaObject::invokeMethod(m_connection, [this, window, hidden] {
+        m_connection->setWindowHidden(window, hidden);
+    }, Qt::QueuedConnection);
 }
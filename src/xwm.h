@@ -2,23 +2,25 @@
 #define XWM_H
 
 #include <cstdint>
-#include <QByteArray>
 #include <QHash>
 #include <QObject>
-#include <QPoint>
 #include <QSize>
-#include <QVector>
+#include <QThread>
 #include <xcb/xcb.h>
 
+#include "xwmconnection.h"
+
 QT_BEGIN_NAMESPACE
 
-class QSocketNotifier;
 class QWaylandSurface;
 
 class Compositor;
 class Xwayland;
 class XwmWindow;
 
+// The window manager of Xwayland. The X connection is handled by an
+// XwmConnection on a thread of its own, and the windows are kept here, on
+// the main thread, from the changes it hands over.
 class Xwm : public QObject
 {
     Q_OBJECT
@@ -27,8 +29,10 @@ public:
     ~Xwm();
     void closeWindow(xcb_window_t window);
     void raiseWindow(xcb_window_t window);
-    void resizeWindow(xcb_window_t window, const QSize &size);
+    void resizeWindow(xcb_window_t window, const QSize &size, uint32_t serial);
+    void sendFrameDrawn(xcb_window_t window, quint64 timestamp);
     void setFocusWindow(xcb_window_t window);
+    void setWindowHidden(xcb_window_t window, bool hidden);
 
     QWaylandSurface *findSurface(uint32_t surfaceId) const;
     QWaylandSurface *surfaceForWindow(xcb_window_t window) const;
@@ -39,44 +43,28 @@ signals:
 
 private slots:
     void initialize();
+    void reset();
     void onSurfaceReady(QWaylandSurface *surface);
     void onSurfaceAboutToBeDestroyed(QWaylandSurface *surface);
-    void processEvents();
+    void onEventsReady(const XwmEventList &events);
 
 private:
-    xcb_atom_t internAtom(const QByteArray &name);
-
-    void syncWindowProperties(xcb_window_t window);
-
-    void handleCreateNotify(xcb_generic_event_t *event);
-    void handleDestroyNotify(xcb_generic_event_t *event);
-    void handleUnmapNotify(xcb_generic_event_t *event);
-    void handleMapNotify(xcb_generic_event_t *event);
-    void handleMapRequest(xcb_generic_event_t *event);
-    void handleConfigureNotify(xcb_generic_event_t *event);
-    void handleConfigureRequest(xcb_generic_event_t *event);
-    void handlePropertyNotify(xcb_generic_event_t *event);
-    void handleClientMessage(xcb_generic_event_t *event);
-
-    void readWindowProperty(xcb_window_t window, xcb_atom_t property);
-    void readWindowTitle(xcb_window_t window, xcb_get_property_reply_t *reply);
-    void readWindowClass(xcb_window_t window, xcb_get_property_reply_t *reply);
-    void readWindowTransientFor(xcb_window_t window,
-                                xcb_get_property_reply_t *reply);
-    void readWindowProtocols(xcb_window_t window,
-                             xcb_get_property_reply_t *reply);
+    void handleEvent(const XwmEvent &event);
+    void setWindowSurfaceId(XwmWindow *xwmWindow, uint32_t surfaceId);
 
     Compositor *m_compositor;
     Xwayland *m_xwayland;
-    xcb_connection_t *m_conn;
-    QSocketNotifier *m_notifier;
 
-    QHash<xcb_window_t, XwmWindow*> m_windows;
-    QHash<uint32_t, xcb_window_t> m_surfaceWindows;
+    QThread m_thread;
+    // Lives in m_thread.
+    XwmConnection *m_connection;
 
-    xcb_atom_t m_atom_wlSurfaceId;
-    xcb_atom_t m_atom_wmProtocols;
-    xcb_atom_t m_atom_wmDeleteWindow;
+    QHash<xcb_window_t, XwmWindow*> m_windows;
+    // The surfaces of Xwayland by their ids, and the windows by the ids of
+    // the surfaces they were last told to be shown with, which may not
+    // exist yet.
+    QHash<uint32_t, QWaylandSurface *> m_surfaces;
+    QHash<uint32_t, XwmWindow *> m_surfaceWindows;
 };
 
 QT_END_NAMESPACE
@@ -0,0 +1,681 @@
+#include "xwmconnection.h"
+
+#include <QDebug>
+#include <QSocketNotifier>
+#include <stdlib.h>
+#include <string.h>
+#include <xcb/composite.h>
+#include <xcb/sync.h>
+
+#include "trace.h"
+
+XwmConnection::XwmConnection()
+{
+    qRegisterMetaType<XwmEventList>();
+}
+
+XwmConnection::~XwmConnection()
+{
+    Q_ASSERT(!m_conn);
+}
+
+void XwmConnection::connectToServer(int fd)
+{
+    m_conn = ::xcb_connect_to_fd(fd, NULL);
+    if (::xcb_connection_has_error(m_conn)) {
+        ::xcb_disconnect(m_conn);
+        m_conn = nullptr;
+        qCritical("error connecting to Xwayland");
+        return;
+    }
+
+    m_notifier = new QSocketNotifier(::xcb_get_file_descriptor(m_conn),
+                                     QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated,
+            this, &XwmConnection::processEvents);
+
+    internAtoms();
+    initializeSync();
+
+    xcb_screen_iterator_t s = ::xcb_setup_roots_iterator(::xcb_get_setup(m_conn));
+    xcb_screen_t *screen = s.data;
+
+    // Created before substructure of the root is selected, so that it is
+    // not seen as a client window.
+    createCheckWindow(screen->root);
+
+    const static uint32_t values[] = {(XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY |
+                                       XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT)};
+    ::xcb_change_window_attributes(m_conn, screen->root,
+                                   XCB_CW_EVENT_MASK, values);
+
+    ::xcb_composite_redirect_subwindows(m_conn, screen->root,
+                                        XCB_COMPOSITE_REDIRECT_MANUAL);
+
+    ::xcb_flush(m_conn);
+}
+
+void XwmConnection::disconnectFromServer()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+    if (m_conn) {
+        ::xcb_disconnect(m_conn);
+        m_conn = nullptr;
+    }
+    m_windows.clear();
+    m_alarms.clear();
+    m_checkWindow = XCB_WINDOW_NONE;
+    m_propertyRequests.clear();
+}
+
+void XwmConnection::internAtoms()
+{
+    // All requests are sent before the first reply is waited for.
+    const struct {
+        const char *name;
+        xcb_atom_t *atom;
+    } atoms[] = {
+        { "WL_SURFACE_ID", &m_atom_wlSurfaceId },
+        { "WM_DELETE_WINDOW", &m_atom_wmDeleteWindow },
+        { "WM_PROTOCOLS", &m_atom_wmProtocols },
+        { "_NET_WM_STATE", &m_atom_netWmState },
+        { "_NET_WM_STATE_HIDDEN", &m_atom_netWmStateHidden },
+        { "_NET_WM_SYNC_REQUEST", &m_atom_netWmSyncRequest },
+        { "_NET_WM_SYNC_REQUEST_COUNTER", &m_atom_netWmSyncRequestCounter },
+        { "_NET_WM_FRAME_DRAWN", &m_atom_netWmFrameDrawn },
+        { "_NET_SUPPORTED", &m_atom_netSupported },
+        { "_NET_SUPPORTING_WM_CHECK", &m_atom_netSupportingWmCheck },
+        { "_NET_WM_NAME", &m_atom_netWmName },
+        { "UTF8_STRING", &m_atom_utf8String },
+    };
+    const int count = sizeof(atoms) / sizeof(atoms[0]);
+    xcb_intern_atom_cookie_t cookies[count];
+    for (int i = 0; i < count; i++) {
+        cookies[i] = ::xcb_intern_atom(m_conn, 0, strlen(atoms[i].name),
+                                       atoms[i].name);
+    }
+    for (int i = 0; i < count; i++) {
+        xcb_intern_atom_reply_t *reply = ::xcb_intern_atom_reply(m_conn,
+                                                                 cookies[i],
+                                                                 NULL);
+        *atoms[i].atom = (reply ? reply->atom : XCB_ATOM_NONE);
+        ::free(reply);
+    }
+}
+
+void XwmConnection::initializeSync()
+{
+    const xcb_query_extension_reply_t *extension =
+            ::xcb_get_extension_data(m_conn, &xcb_sync_id);
+    if (!extension || !extension->present) {
+        qWarning("Xwayland has no SYNC extension, resizes of X windows are "
+                 "not synchronized");
+        m_syncFirstEvent = 0;
+        return;
+    }
+    xcb_sync_initialize_cookie_t cookie = ::xcb_sync_initialize(m_conn, 3, 1);
+    ::free(::xcb_sync_initialize_reply(m_conn, cookie, NULL));
+    m_syncFirstEvent = extension->first_event;
+}
+
+void XwmConnection::createCheckWindow(xcb_window_t root)
+{
+    // Clients only use the EWMH hints in _NET_SUPPORTED when it is there.
+    m_checkWindow = ::xcb_generate_id(m_conn);
+    const static uint32_t values[] = {1};
+    ::xcb_create_window(m_conn, XCB_COPY_FROM_PARENT, m_checkWindow, root,
+                        -1, -1, 1, 1, 0, XCB_WINDOW_CLASS_INPUT_ONLY,
+                        XCB_COPY_FROM_PARENT, XCB_CW_OVERRIDE_REDIRECT, values);
+    ::xcb_change_property(m_conn, XCB_PROP_MODE_REPLACE, m_checkWindow,
+                          m_atom_netSupportingWmCheck, XCB_ATOM_WINDOW, 32,
+                          1, &m_checkWindow);
+    const char name[] = "newcompositor";
+    ::xcb_change_property(m_conn, XCB_PROP_MODE_REPLACE, m_checkWindow,
+                          m_atom_netWmName, m_atom_utf8String, 8,
+                          sizeof(name) - 1, name);
+    ::xcb_change_property(m_conn, XCB_PROP_MODE_REPLACE, root,
+                          m_atom_netSupportingWmCheck, XCB_ATOM_WINDOW, 32,
+                          1, &m_checkWindow);
+
+    QVector<xcb_atom_t> supported = {
+        m_atom_netWmState,
+        m_atom_netWmStateHidden,
+    };
+    if (m_syncFirstEvent) {
+        supported << m_atom_netWmSyncRequest << m_atom_netWmFrameDrawn;
+    }
+    ::xcb_change_property(m_conn, XCB_PROP_MODE_REPLACE, root,
+                          m_atom_netSupported, XCB_ATOM_ATOM, 32,
+                          supported.size(), supported.constData());
+}
+
+void XwmConnection::scheduleFlush()
+{
+    // Requests queued from the main thread in one go are handled before
+    // this, and flushed together.
+    if (!m_flushPending) {
+        m_flushPending = true;
+        QMetaObject::invokeMethod(this, [this] { flush(); },
+                                  Qt::QueuedConnection);
+    }
+}
+
+void XwmConnection::flush()
+{
+    m_flushPending = false;
+    if (m_conn) {
+        ::xcb_flush(m_conn);
+    }
+}
+
+void XwmConnection::processEvents()
+{
+    TraceSpan span("xwmEvents");
+    int count = 0;
+    xcb_generic_event_t *event = ::xcb_poll_for_event(m_conn);
+    for (;;) {
+        for (; event; event = ::xcb_poll_for_event(m_conn)) {
+            handleEvent(event);
+            ::free(event);
+            count++;
+        }
+        if (m_propertyRequests.isEmpty()) {
+            break;
+        }
+        ::xcb_flush(m_conn);
+        resolveWindowProperties();
+        // Events that came while waiting for the replies were read from the
+        // socket already, so the socket notifier does not tell about them.
+        event = ::xcb_poll_for_queued_event(m_conn);
+    }
+    if (count) {
+        ::xcb_flush(m_conn);
+    }
+    Trace::counter("xwmEvents", count);
+    if (!m_events.isEmpty()) {
+        emit eventsReady(m_events);
+        m_events.clear();
+    }
+}
+
+void XwmConnection::handleEvent(xcb_generic_event_t *event)
+{
+    switch (event->response_type & ~0x80) {
+    case 0:
+        break;
+    case XCB_CREATE_NOTIFY:
+        handleCreateNotify(event);
+        break;
+    case XCB_DESTROY_NOTIFY:
+        handleDestroyNotify(event);
+        break;
+    case XCB_UNMAP_NOTIFY:
+        handleUnmapNotify(event);
+        break;
+    case XCB_MAP_NOTIFY:
+        handleMapNotify(event);
+        break;
+    case XCB_MAP_REQUEST:
+        handleMapRequest(event);
+        break;
+    case XCB_CONFIGURE_NOTIFY:
+        handleConfigureNotify(event);
+        break;
+    case XCB_CONFIGURE_REQUEST:
+        handleConfigureRequest(event);
+        break;
+    case XCB_PROPERTY_NOTIFY:
+        handlePropertyNotify(event);
+        break;
+    case XCB_CLIENT_MESSAGE:
+        handleClientMessage(event);
+        break;
+    case XCB_MAPPING_NOTIFY:
+        break;
+    default:
+        if (m_syncFirstEvent && (event->response_type & ~0x80) ==
+                m_syncFirstEvent + XCB_SYNC_ALARM_NOTIFY) {
+            handleSyncAlarmNotify(event);
+        }
+        // Other events, such as counter notifies of the SYNC extension,
+        // are of no interest.
+        break;
+    }
+}
+
+void XwmConnection::handleCreateNotify(xcb_generic_event_t *event)
+{
+    auto notify = reinterpret_cast<xcb_create_notify_event_t *>(event);
+    const xcb_window_t window = notify->window;
+    m_windows.insert(window, WindowState());
+    XwmEvent created = {XwmEvent::Created, window};
+    created.overrideRedirect = notify->override_redirect;
+    m_events.append(created);
+    const static uint32_t values[] = {XCB_EVENT_MASK_PROPERTY_CHANGE};
+    ::xcb_change_window_attributes(m_conn, window, XCB_CW_EVENT_MASK, values);
+    readWindowProperty(window, XCB_ATOM_WM_TRANSIENT_FOR);
+    readWindowProperty(window, m_atom_wmProtocols);
+    readWindowProperty(window, m_atom_netWmSyncRequestCounter);
+}
+
+void XwmConnection::handleDestroyNotify(xcb_generic_event_t *event)
+{
+    auto notify = reinterpret_cast<xcb_destroy_notify_event_t *>(event);
+    auto it = m_windows.find(notify->window);
+    if (it != m_windows.end()) {
+        destroyAlarm(it.value());
+        m_windows.erase(it);
+        m_events.append({XwmEvent::Destroyed, notify->window});
+    }
+}
+
+void XwmConnection::handleMapRequest(xcb_generic_event_t *event)
+{
+    auto request = reinterpret_cast<xcb_map_request_event_t *>(event);
+    ::xcb_map_window(m_conn, request->window);
+}
+
+void XwmConnection::handleUnmapNotify(xcb_generic_event_t *event)
+{
+    auto notify = reinterpret_cast<xcb_unmap_notify_event_t *>(event);
+    if (m_windows.contains(notify->window)) {
+        m_events.append({XwmEvent::Unmapped, notify->window});
+    }
+}
+
+void XwmConnection::handleMapNotify(xcb_generic_event_t *event)
+{
+    auto notify = reinterpret_cast<xcb_map_notify_event_t *>(event);
+    if (m_windows.contains(notify->window)) {
+        XwmEvent mapped = {XwmEvent::Mapped, notify->window};
+        mapped.overrideRedirect = notify->override_redirect;
+        m_events.append(mapped);
+    }
+}
+
+void XwmConnection::handleConfigureNotify(xcb_generic_event_t *event)
+{
+    auto notify = reinterpret_cast<xcb_configure_notify_event_t *>(event);
+    if (m_windows.contains(notify->window)) {
+        XwmEvent moved = {XwmEvent::Moved, notify->window};
+        moved.overrideRedirect = notify->override_redirect;
+        moved.position = QPoint(notify->x, notify->y);
+        m_events.append(moved);
+    }
+}
+
+void XwmConnection::handleConfigureRequest(xcb_generic_event_t *event)
+{
+    auto request = reinterpret_cast<xcb_configure_request_event_t *>(event);
+    if (m_windows.contains(request->window)) {
+        XwmEvent moveRequested = {XwmEvent::MoveRequested, request->window};
+        moveRequested.position = QPoint(request->x, request->y);
+        m_events.append(moveRequested);
+    }
+}
+
+void XwmConnection::handlePropertyNotify(xcb_generic_event_t *event)
+{
+    auto notify = reinterpret_cast<xcb_property_notify_event_t *>(event);
+    if (m_windows.contains(notify->window)) {
+        readWindowProperty(notify->window, notify->atom);
+    }
+}
+
+void XwmConnection::handleClientMessage(xcb_generic_event_t *event)
+{
+    auto message = reinterpret_cast<xcb_client_message_event_t *>(event);
+    if (!m_windows.contains(message->window)) {
+        return;
+    }
+    if (message->type == m_atom_wlSurfaceId) {
+        XwmEvent surfaceIdChanged = {XwmEvent::SurfaceIdChanged, message->window};
+        surfaceIdChanged.value = message->data.data32[0];
+        m_events.append(surfaceIdChanged);
+    }
+}
+
+void XwmConnection::handleSyncAlarmNotify(xcb_generic_event_t *event)
+{
+    auto notify = reinterpret_cast<xcb_sync_alarm_notify_event_t *>(event);
+    auto it = m_windows.find(m_alarms.value(notify->alarm, XCB_WINDOW_NONE));
+    if (it == m_windows.end()) {
+        return;
+    }
+    WindowState &state = it.value();
+    if (notify->state == XCB_SYNC_ALARMSTATE_DESTROYED) {
+        // The client destroyed the counter.
+        destroyAlarm(state);
+        state.counter = XCB_NONE;
+        updateWindowSync(it.key(), state);
+        return;
+    }
+
+    const int64_t value = ((int64_t(notify->counter_value.hi) << 32) |
+                           notify->counter_value.lo);
+    state.counterKnown = true;
+    state.counterValue = value;
+    if (state.resizePending && value >= state.resizeValue) {
+        state.resizePending = false;
+        XwmEvent resizeDone = {XwmEvent::ResizeDone, it.key()};
+        resizeDone.value = state.resizeSerial;
+        m_events.append(resizeDone);
+    }
+    // Extended counters are odd while the client draws a frame.
+    if (state.extendedCounter && value % 2 == 0 &&
+            value > state.completedValue) {
+        state.completedValue = value;
+        if (!state.frameCompleted) {
+            state.frameCompleted = true;
+            m_events.append({XwmEvent::FrameCompleted, it.key()});
+        }
+    }
+    updateWindowSync(it.key(), state);
+}
+
+void XwmConnection::readWindowProperty(xcb_window_t window, xcb_atom_t property)
+{
+    // Only properties that are used are read, each at most once a batch,
+    // and only as long as it needs to be, in 32-bit units.
+    uint32_t length;
+    if (property == XCB_ATOM_WM_NAME || property == XCB_ATOM_WM_CLASS) {
+        length = 2048;
+    } else if (property == XCB_ATOM_WM_TRANSIENT_FOR) {
+        length = 1;
+    } else if (property == m_atom_wmProtocols) {
+        length = 32;
+    } else if (property == m_atom_netWmSyncRequestCounter) {
+        length = 2;
+    } else {
+        return;
+    }
+    for (const PropertyRequest &request : qAsConst(m_propertyRequests)) {
+        if (request.window == window && request.property == property) {
+            return;
+        }
+    }
+    xcb_get_property_cookie_t cookie = ::xcb_get_property(m_conn, 0, window,
+                                                          property,
+                                                          XCB_ATOM_ANY,
+                                                          0, length);
+    m_propertyRequests.append({window, property, cookie});
+}
+
+void XwmConnection::resolveWindowProperties()
+{
+    for (const PropertyRequest &request : qAsConst(m_propertyRequests)) {
+        xcb_get_property_reply_t *reply = ::xcb_get_property_reply(m_conn,
+                                                                   request.cookie,
+                                                                   NULL);
+        if (reply == nullptr) {
+            continue;
+        }
+        // The window may have been destroyed since.
+        if (m_windows.contains(request.window)) {
+            if (request.property == XCB_ATOM_WM_NAME) {
+                readWindowTitle(request.window, reply);
+            } else if (request.property == XCB_ATOM_WM_CLASS) {
+                readWindowClass(request.window, reply);
+            } else if (request.property == XCB_ATOM_WM_TRANSIENT_FOR) {
+                readWindowTransientFor(request.window, reply);
+            } else if (request.property == m_atom_wmProtocols) {
+                readWindowProtocols(request.window, reply);
+            } else if (request.property == m_atom_netWmSyncRequestCounter) {
+                readWindowSyncCounters(request.window, reply);
+            }
+        }
+        ::free(reply);
+    }
+    m_propertyRequests.clear();
+}
+
+void XwmConnection::readWindowTitle(xcb_window_t window,
+                                    xcb_get_property_reply_t *reply)
+{
+    int len = ::xcb_get_property_value_length(reply);
+    auto *title = reinterpret_cast<char *>(::xcb_get_property_value(reply));
+    XwmEvent titleChanged = {XwmEvent::TitleChanged, window};
+    titleChanged.text = QString::fromLocal8Bit(title, len);
+    m_events.append(titleChanged);
+}
+
+void XwmConnection::readWindowClass(xcb_window_t window,
+                                    xcb_get_property_reply_t *reply)
+{
+    int len = ::xcb_get_property_value_length(reply);
+    auto *className = reinterpret_cast<char *>(::xcb_get_property_value(reply));
+    XwmEvent classNameChanged = {XwmEvent::ClassNameChanged, window};
+    classNameChanged.text = QString::fromLocal8Bit(className, len);
+    m_events.append(classNameChanged);
+}
+
+void XwmConnection::readWindowTransientFor(xcb_window_t window,
+                                           xcb_get_property_reply_t *reply)
+{
+    // Empty when the property was deleted.
+    xcb_window_t transientFor = XCB_WINDOW_NONE;
+    if (::xcb_get_property_value_length(reply) >= int(sizeof(xcb_window_t))) {
+        transientFor = *reinterpret_cast<xcb_window_t *>(::xcb_get_property_value(reply));
+    }
+    XwmEvent transientForChanged = {XwmEvent::TransientForChanged, window};
+    transientForChanged.value = transientFor;
+    m_events.append(transientForChanged);
+}
+
+void XwmConnection::readWindowProtocols(xcb_window_t window,
+                                        xcb_get_property_reply_t *reply)
+{
+    WindowState &state = m_windows[window];
+    state.supportsDelete = false;
+    state.supportsSyncRequest = false;
+    uint32_t len = ::xcb_get_property_value_length(reply) / sizeof(xcb_atom_t);
+    auto *atoms = reinterpret_cast<xcb_atom_t *>(::xcb_get_property_value(reply));
+    for (uint32_t i = 0; i < len; i++) {
+        if (atoms[i] == m_atom_wmDeleteWindow) {
+            state.supportsDelete = true;
+        } else if (atoms[i] == m_atom_netWmSyncRequest) {
+            state.supportsSyncRequest = true;
+        }
+    }
+    updateWindowSync(window, state);
+}
+
+void XwmConnection::readWindowSyncCounters(xcb_window_t window,
+                                           xcb_get_property_reply_t *reply)
+{
+    // The basic counter, optionally followed by the extended one.
+    const int count = (::xcb_get_property_value_length(reply) /
+                       int(sizeof(xcb_sync_counter_t)));
+    auto *counters = reinterpret_cast<xcb_sync_counter_t *>(
+                ::xcb_get_property_value(reply));
+    const xcb_sync_counter_t counter = (count > 0 ? counters[count > 1 ? 1 : 0]
+                                                  : XCB_NONE);
+    WindowState &state = m_windows[window];
+    if (counter == state.counter) {
+        return;
+    }
+    destroyAlarm(state);
+    state.counter = counter;
+    state.extendedCounter = (count > 1);
+    updateWindowSync(window, state);
+}
+
+void XwmConnection::updateWindowSync(xcb_window_t window, WindowState &state)
+{
+    if (m_syncFirstEvent && state.counter != XCB_NONE &&
+            state.alarm == XCB_NONE) {
+        // Fires right away with the current value of the counter, and then
+        // on each of its increments.
+        state.alarm = ::xcb_generate_id(m_conn);
+        const uint32_t mask = (XCB_SYNC_CA_COUNTER | XCB_SYNC_CA_VALUE_TYPE |
+                               XCB_SYNC_CA_VALUE | XCB_SYNC_CA_TEST_TYPE |
+                               XCB_SYNC_CA_DELTA | XCB_SYNC_CA_EVENTS);
+        const uint32_t values[] = {
+            state.counter,
+            XCB_SYNC_VALUETYPE_RELATIVE, 0, 0,
+            XCB_SYNC_TESTTYPE_POSITIVE_COMPARISON,
+            0, 1,
+            1,
+        };
+        ::xcb_sync_create_alarm(m_conn, state.alarm, mask, values);
+        m_alarms.insert(state.alarm, window);
+        // Created after the batch of events was flushed.
+        scheduleFlush();
+    }
+
+    const bool synced = (state.supportsSyncRequest && state.counterKnown);
+    if (synced != state.synced) {
+        state.synced = synced;
+        state.resizePending = false;
+        XwmEvent syncChanged = {XwmEvent::SyncChanged, window};
+        syncChanged.value = synced;
+        m_events.append(syncChanged);
+    }
+}
+
+void XwmConnection::destroyAlarm(WindowState &state)
+{
+    if (state.alarm != XCB_NONE) {
+        ::xcb_sync_destroy_alarm(m_conn, state.alarm);
+        m_alarms.remove(state.alarm);
+        state.alarm = XCB_NONE;
+    }
+    state.counterKnown = false;
+    state.frameCompleted = false;
+    state.completedValue = 0;
+}
+
+void XwmConnection::closeWindow(xcb_window_t window)
+{
+    if (!m_conn || !m_windows.contains(window)) {
+        return;
+    }
+    if (m_windows.value(window).supportsDelete) {
+        xcb_client_message_data_t messageData = {0};
+        messageData.data32[0] = m_atom_wmDeleteWindow;
+        messageData.data32[1] = XCB_CURRENT_TIME;
+        xcb_client_message_event_t event = {
+            .response_type = XCB_CLIENT_MESSAGE,
+            .format = 32,
+            .sequence = 0,
+            .window = window,
+            .type = m_atom_wmProtocols,
+            .data = messageData
+        };
+        ::xcb_send_event(m_conn, 0, window, XCB_EVENT_MASK_NO_EVENT,
+                         reinterpret_cast<const char *>(&event));
+    } else {
+        ::xcb_kill_client(m_conn, window);
+    }
+    scheduleFlush();
+}
+
+void XwmConnection::raiseWindow(xcb_window_t window)
+{
+    if (!m_conn) {
+        return;
+    }
+    uint16_t mask = XCB_CONFIG_WINDOW_STACK_MODE;
+    uint32_t values[] = {XCB_STACK_MODE_ABOVE};
+    ::xcb_configure_window(m_conn, window, mask, values);
+    scheduleFlush();
+}
+
+void XwmConnection::setFocusWindow(xcb_window_t window)
+{
+    if (!m_conn) {
+        return;
+    }
+    ::xcb_set_input_focus(m_conn, XCB_INPUT_FOCUS_POINTER_ROOT, window,
+                          XCB_CURRENT_TIME);
+    scheduleFlush();
+}
+
+void XwmConnection::resizeWindow(xcb_window_t window, const QSize &size,
+                                 uint32_t serial)
+{
+    if (!m_conn) {
+        return;
+    }
+    auto it = m_windows.find(window);
+    if (it != m_windows.end() && it.value().synced) {
+        WindowState &state = it.value();
+        const int64_t base = qMax(state.counterValue, state.resizePending ?
+                                      state.resizeValue : 0);
+        // An extended counter is even between frames, and one that is odd
+        // belongs to a frame drawn before the resize, so the value is the
+        // end of the frame after it.
+        state.resizeValue = (state.extendedCounter ? (base | 1) + 3
+                                                   : base + 1);
+        state.resizeSerial = serial;
+        state.resizePending = true;
+
+        xcb_client_message_data_t messageData = {0};
+        messageData.data32[0] = m_atom_netWmSyncRequest;
+        messageData.data32[1] = XCB_CURRENT_TIME;
+        messageData.data32[2] = uint32_t(state.resizeValue);
+        messageData.data32[3] = uint32_t(state.resizeValue >> 32);
+        messageData.data32[4] = (state.extendedCounter ? 1 : 0);
+        xcb_client_message_event_t event = {
+            .response_type = XCB_CLIENT_MESSAGE,
+            .format = 32,
+            .sequence = 0,
+            .window = window,
+            .type = m_atom_wmProtocols,
+            .data = messageData
+        };
+        ::xcb_send_event(m_conn, 0, window, XCB_EVENT_MASK_NO_EVENT,
+                         reinterpret_cast<const char *>(&event));
+    }
+    uint16_t mask = (XCB_CONFIG_WINDOW_WIDTH |
+                     XCB_CONFIG_WINDOW_HEIGHT);
+    uint32_t values[] = {(uint32_t) size.width(), (uint32_t) size.height()};
+    ::xcb_configure_window(m_conn, window, mask, values);
+    scheduleFlush();
+}
+
+void XwmConnection::sendFrameDrawn(xcb_window_t window, quint64 timestamp)
+{
+    if (!m_conn) {
+        return;
+    }
+    auto it = m_windows.find(window);
+    if (it == m_windows.end() || !it.value().frameCompleted) {
+        return;
+    }
+    WindowState &state = it.value();
+    state.frameCompleted = false;
+
+    // Clients compare the time to their monotonic clock in microseconds.
+    const quint64 time = timestamp / 1000;
+    xcb_client_message_data_t messageData = {0};
+    messageData.data32[0] = uint32_t(state.completedValue);
+    messageData.data32[1] = uint32_t(state.completedValue >> 32);
+    messageData.data32[2] = uint32_t(time);
+    messageData.data32[3] = uint32_t(time >> 32);
+    xcb_client_message_event_t event = {
+        .response_type = XCB_CLIENT_MESSAGE,
+        .format = 32,
+        .sequence = 0,
+        .window = window,
+        .type = m_atom_netWmFrameDrawn,
+        .data = messageData
+    };
+    ::xcb_send_event(m_conn, 0, window, XCB_EVENT_MASK_NO_EVENT,
+                     reinterpret_cast<const char *>(&event));
+    scheduleFlush();
+}
+
+void XwmConnection::setWindowHidden(xcb_window_t window, bool hidden)
+{
+    if (!m_conn) {
+        return;
+    }
+    // No other states are managed, so the property is replaced.
+    const xcb_atom_t state = m_atom_netWmStateHidden;
+    ::xcb_change_property(m_conn, XCB_PROP_MODE_REPLACE, window,
+                          m_atom_netWmState, XCB_ATOM_ATOM, 32,
+                          hidden ? 1 : 0, &state);
+    scheduleFlush();
+}
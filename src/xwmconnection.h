@@ -0,0 +1,179 @@
+#ifndef XWMCONNECTION_H
+#define XWMCONNECTION_H
+
+#include <cstdint>
+#include <QHash>
+#include <QMetaType>
+#include <QObject>
+#include <QPoint>
+#include <QSize>
+#include <QString>
+#include <QVector>
+#include <xcb/sync.h>
+#include <xcb/xcb.h>
+
+QT_BEGIN_NAMESPACE
+
+class QSocketNotifier;
+
+// A change of the state of an X window, decoded from X events for the
+// main thread.
+struct XwmEvent
+{
+    enum Type {
+        Created,
+        Destroyed,
+        Mapped,
+        Unmapped,
+        Moved,
+        MoveRequested,
+        TitleChanged,
+        ClassNameChanged,
+        TransientForChanged,
+        SurfaceIdChanged,
+        SyncChanged,
+        ResizeDone,
+        FrameCompleted,
+    };
+
+    XwmEvent(Type type = Created, xcb_window_t window = XCB_WINDOW_NONE)
+        : type(type), window(window) {}
+
+    Type type;
+    xcb_window_t window;
+    bool overrideRedirect = false;
+    QPoint position;
+    // The surface id, the window the window is transient for, whether
+    // resizes of the window are synchronized, or the serial of a resize.
+    uint32_t value = 0;
+    QString text;
+};
+
+typedef QVector<XwmEvent> XwmEventList;
+
+// The connection of the window manager to Xwayland, which lives in a thread
+// of its own so that X clients cannot hold up the compositor. It reads and
+// decodes the X events, and hands what changed to the main thread once a
+// batch. Requests are flushed once a batch as well.
+class XwmConnection : public QObject
+{
+    Q_OBJECT
+public:
+    XwmConnection();
+    ~XwmConnection();
+
+    // All of these are to be called in the thread of the connection.
+    void connectToServer(int fd);
+    void disconnectFromServer();
+    void closeWindow(xcb_window_t window);
+    void raiseWindow(xcb_window_t window);
+    // Asks clients that support _NET_WM_SYNC_REQUEST to tell when they have
+    // drawn at the new size, which is reported with the serial.
+    void resizeWindow(xcb_window_t window, const QSize &size, uint32_t serial);
+    // Tells a client with an extended sync counter that its last complete
+    // frame has been drawn, at a time on the monotonic clock in nanoseconds.
+    void sendFrameDrawn(xcb_window_t window, quint64 timestamp);
+    void setFocusWindow(xcb_window_t window);
+    void setWindowHidden(xcb_window_t window, bool hidden);
+
+signals:
+    void eventsReady(const XwmEventList &events);
+
+private:
+    void internAtoms();
+    void initializeSync();
+    void createCheckWindow(xcb_window_t root);
+    void scheduleFlush();
+    void flush();
+    void processEvents();
+    void handleEvent(xcb_generic_event_t *event);
+
+    void handleCreateNotify(xcb_generic_event_t *event);
+    void handleDestroyNotify(xcb_generic_event_t *event);
+    void handleUnmapNotify(xcb_generic_event_t *event);
+    void handleMapNotify(xcb_generic_event_t *event);
+    void handleMapRequest(xcb_generic_event_t *event);
+    void handleConfigureNotify(xcb_generic_event_t *event);
+    void handleConfigureRequest(xcb_generic_event_t *event);
+    void handlePropertyNotify(xcb_generic_event_t *event);
+    void handleClientMessage(xcb_generic_event_t *event);
+    void handleSyncAlarmNotify(xcb_generic_event_t *event);
+
+    void readWindowProperty(xcb_window_t window, xcb_atom_t property);
+    void resolveWindowProperties();
+    void readWindowTitle(xcb_window_t window, xcb_get_property_reply_t *reply);
+    void readWindowClass(xcb_window_t window, xcb_get_property_reply_t *reply);
+    void readWindowTransientFor(xcb_window_t window,
+                                xcb_get_property_reply_t *reply);
+    void readWindowProtocols(xcb_window_t window,
+                             xcb_get_property_reply_t *reply);
+    void readWindowSyncCounters(xcb_window_t window,
+                                xcb_get_property_reply_t *reply);
+
+    struct WindowState
+    {
+        bool supportsDelete = false;
+        bool supportsSyncRequest = false;
+        // The extended counter of _NET_WM_SYNC_REQUEST_COUNTER when there
+        // is one, else the basic one, and an alarm that fires on each of its
+        // increments.
+        xcb_sync_counter_t counter = XCB_NONE;
+        bool extendedCounter = false;
+        xcb_sync_alarm_t alarm = XCB_NONE;
+        bool counterKnown = false;
+        int64_t counterValue = 0;
+        // Whether the main thread was told that resizes are synchronized.
+        bool synced = false;
+        // The value the counter reaches once the client has drawn at the
+        // size of the last resize.
+        bool resizePending = false;
+        int64_t resizeValue = 0;
+        uint32_t resizeSerial = 0;
+        // The last frame the client completed, not yet reported as drawn.
+        bool frameCompleted = false;
+        int64_t completedValue = 0;
+    };
+    void updateWindowSync(xcb_window_t window, WindowState &state);
+    void destroyAlarm(WindowState &state);
+
+    xcb_connection_t *m_conn = nullptr;
+    QSocketNotifier *m_notifier = nullptr;
+    bool m_flushPending = false;
+
+    QHash<xcb_window_t, WindowState> m_windows;
+    QHash<xcb_sync_alarm_t, xcb_window_t> m_alarms;
+    // Zero when the server has no SYNC extension.
+    uint8_t m_syncFirstEvent = 0;
+    xcb_window_t m_checkWindow = XCB_WINDOW_NONE;
+    // Changes not yet handed to the main thread.
+    XwmEventList m_events;
+
+    // Properties requested while handling a batch of events, whose replies
+    // are read when the batch is done, in a single round trip.
+    struct PropertyRequest
+    {
+        xcb_window_t window;
+        xcb_atom_t property;
+        xcb_get_property_cookie_t cookie;
+    };
+    QVector<PropertyRequest> m_propertyRequests;
+
+    xcb_atom_t m_atom_wlSurfaceId;
+    xcb_atom_t m_atom_wmProtocols;
+    xcb_atom_t m_atom_wmDeleteWindow;
+    xcb_atom_t m_atom_netWmState;
+    xcb_atom_t m_atom_netWmStateHidden;
+    xcb_atom_t m_atom_netWmSyncRequest;
+    xcb_atom_t m_atom_netWmSyncRequestCounter;
+    xcb_atom_t m_atom_netWmFrameDrawn;
+    xcb_atom_t m_atom_netSupported;
+    xcb_atom_t m_atom_netSupportingWmCheck;
+    xcb_atom_t m_atom_netWmName;
+    xcb_atom_t m_atom_utf8String;
+};
+
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(XwmEventList)
+
+#endif // XWMCONNECTION_H
@@ -7,11 +7,19 @@
 
 #include "xwm.h"
 
+// How long the window waits for a client to draw at its new size before
+// it is shown stretched, in milliseconds.
+static const int resizeTimeout = 200;
+
 XwmWindow::XwmWindow(Xwm *xwm, xcb_window_t window)
     : QObject(xwm)
     , m_xwm(xwm)
     , m_window(window)
 {
+    m_resizeTimer.setSingleShot(true);
+    m_resizeTimer.setInterval(resizeTimeout);
+    connect(&m_resizeTimer, &QTimer::timeout,
+            this, &XwmWindow::finishResize);
 }
 
 void XwmWindow::setSurface(QWaylandSurface *surface)
@@ -25,6 +33,8 @@ void XwmWindow::setSurface(QWaylandSurface *surface)
         connect(surface, &QObject::destroyed,
                 this, &XwmWindow::onSurfaceDestroyed,
                 Qt::DirectConnection);
+        connect(surface, &QWaylandSurface::redraw,
+                this, &XwmWindow::onSurfaceRedraw);
         emit m_xwm->windowBoundToSurface(this, previousSurface);
         maybeSetPopup();
     }
@@ -42,6 +52,9 @@ void XwmWindow::onSurfaceDestroyed()
 void XwmWindow::setMapped(bool mapped)
 {
     m_mapped = mapped;
+    if (!mapped) {
+        finishResize();
+    }
     if (m_surface) {
         emit m_surface->hasContentChanged();
     }
@@ -75,7 +88,65 @@ void XwmWindow::setPosition(const QPoint &pos)
 
 void XwmWindow::resize(const QSize &size)
 {
-    m_xwm->resizeWindow(m_window, size);
+    m_resizeSerial++;
+    m_xwm->resizeWindow(m_window, size, m_resizeSerial);
+    if (m_syncsResizes && m_mapped && m_surface &&
+            m_surface->destinationSize() != size) {
+        m_resizeState = WaitingForClient;
+        m_resizeSize = size;
+        m_resizeTimer.start();
+    }
+}
+
+void XwmWindow::setSyncsResizes(bool syncsResizes)
+{
+    m_syncsResizes = syncsResizes;
+    if (!syncsResizes) {
+        finishResize();
+    }
+}
+
+void XwmWindow::setResizeDone(uint32_t serial)
+{
+    // Done with a resize that was superseded.
+    if (serial != m_resizeSerial || m_resizeState != WaitingForClient) {
+        return;
+    }
+    // The counter and the frame come over different connections, so the
+    // frame may not have been committed yet. A client that keeps its size
+    // is done with its next frame.
+    if (m_surface && m_surface->destinationSize() == m_resizeSize) {
+        finishResize();
+    } else {
+        m_resizeState = WaitingForCommit;
+    }
+}
+
+void XwmWindow::onSurfaceRedraw()
+{
+    // Frames committed before the client was done may be at the new size
+    // too, but not yet drawn.
+    if (m_resizeState == WaitingForCommit) {
+        finishResize();
+    }
+}
+
+void XwmWindow::finishResize()
+{
+    if (m_resizeState == NoResize) {
+        return;
+    }
+    m_resizeState = NoResize;
+    m_resizeTimer.stop();
+    emit resizeFinished();
+}
+
+void XwmWindow::sendFrameDrawn(quint64 timestamp)
+{
+    if (m_frameCompleted) {
+        m_frameCompleted = false;
+        m_xwm->sendFrameDrawn(m_window, timestamp);
+    }
 }
 
 void XwmWindow::sendClose()
@@ -92,3 +163,8 @@ void XwmWindow::setFocus()
 {
     m_xwm->setFocusWindow(m_window);
 }
+
+void XwmWindow::setHidden(bool hidden)
+{
+    m_xwm->setWindowHidden(m_window, hidden);
+}
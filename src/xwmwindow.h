@@ -4,7 +4,9 @@
 #include <QObject>
 #include <QPoint>
 #include <QPointer>
+#include <QSize>
 #include <QString>
+#include <QTimer>
 #include <xcb/xcb.h>
 
 QT_BEGIN_NAMESPACE
@@ -22,9 +24,15 @@ public:
     QWaylandSurface *surface() const { return m_surface; }
 
     void resize(const QSize &size);
+    // Whether the window waits for the client to draw at the size it was
+    // last resized to.
+    bool isResizePending() const { return m_resizeState != NoResize; }
+    // Tells the client that the frame it completed last has been drawn.
+    void sendFrameDrawn(quint64 timestamp);
     void sendClose();
     void raise();
     void setFocus();
+    void setHidden(bool hidden);
 
     bool isMapped() const { return m_mapped; }
     QString className() const { return m_className; }
@@ -33,9 +41,12 @@ public:
 signals:
     void positionChanged(const QPoint &pos);
     void setPopup(QWaylandSurface *parentSurface, const QPoint &pos);
+    void resizeFinished();
 
 private slots:
     void onSurfaceDestroyed();
+    void onSurfaceRedraw();
+    void finishResize();
 
 private:
     friend class Xwm;
@@ -49,9 +60,18 @@ private:
     void setPosition(const QPoint &pos);
     void setTitle(const QString &title) { m_title = title; }
     void setClassName(const QString &className) { m_className = className; }
+    void setSyncsResizes(bool syncsResizes);
+    void setResizeDone(uint32_t serial);
+
+    enum ResizeState {
+        NoResize,
+        WaitingForClient,
+        // The client has drawn, but Xwayland has yet to commit the frame.
+        WaitingForCommit,
+    };
 
     Xwm *m_xwm;
-    uint32_t m_surfaceId;
+    uint32_t m_surfaceId = 0;
     QWaylandSurface *m_surface = nullptr;
     xcb_window_t m_window;
 
@@ -61,8 +81,15 @@ private:
 
     QString m_title;
     QString m_className;
-    xcb_window_t m_transientFor;
-    QVector<xcb_atom_t> m_protocols;
+    xcb_window_t m_transientFor = XCB_WINDOW_NONE;
+
+    // Whether the client tells when it has drawn at a new size.
+    bool m_syncsResizes = false;
+    ResizeState m_resizeState = NoResize;
+    QSize m_resizeSize;
+    uint32_t m_resizeSerial = 0;
+    QTimer m_resizeTimer;
+    bool m_frameCompleted = false;
 };
 
 QT_END_NAMESPACE